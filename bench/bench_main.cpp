@@ -0,0 +1,252 @@
+//Closed loop regulation benchmark, built by [env:bench] on top of the host simulation (sim/sim.h).
+//Steps the setpoint and the source voltage of every regulation mode through the scenario table below, prints
+//the results as JSON on stdout and exits with 1 if any scenario misses its limits or the fixed point
+//calibration math (measure.h) is off.
+//Usage: program [-n]     -n reports only, never fails
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+#include "regulator.h"
+#include "cv.h"
+#include "measure.h"
+
+void setup();
+void remote_mode(int level);
+void set_remote_sense(bool remote);
+extern int Menu_level;
+extern bool pause;
+extern long ohm_setpoint, mA_setpoint, mW_setpoint, mV_setpoint;
+extern Pid regulator;
+
+#define MODE_CR 5
+#define MODE_CC 6
+#define MODE_CP 7
+#define MODE_CV 17
+
+#define SETTLE_BAND     0.01    //settled when within 1% of the target
+#define PRE_STEP_US     1000000 //time given to settle on the first setpoint
+#define WINDOW_US       1000000 //measurement window after the step
+#define RIPPLE_US       200000  //tail of the window used for the steady state ripple
+#define BOOT_US         4000000 //from power up to the first scenario step
+
+//Blocking wait detector. The simulator charges every loop() pass a fixed SimConfig.loop_us of CPU time, so the
+//pass rate says nothing about what the code costs: time beyond that is only ever lost in a wait inside loop()
+//(delay(), a busy I2C, ADC or EEPROM poll). blocked_pct is the part of the window lost that way.
+#define MAX_BLOCKED_PCT 1.0
+
+struct Scenario {
+  const char *name;
+  int mode;
+  float setpoint_before;        //ohm, mA or mW. 0 means the step is the mode entry itself
+  float setpoint_after;
+  double source_before;         //V
+  double source_after;
+  //limits, a regression fails the run
+  double max_settle_ms;
+  double max_overshoot_pct;
+  double max_ripple_lsb;
+  double source_r;              //ohm, 0 for the default of the simulator
+  double lead_r;                //ohm in each force lead, above 0 the scenario runs with remote sense
+};
+
+static const Scenario scenarios[] = {
+  //name                 mode     before   after    Vbefore Vafter  settle  overshoot ripple Rs    Rlead
+  {"cc_entry_1000mA",    MODE_CC, 0,       1000,    12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cc_step_1000_3000mA",MODE_CC, 1000,    3000,    12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cc_line_12_9V",      MODE_CC, 1000,    1000,    12.0,   9.0,    60,     3,        4,     0,    0},
+  {"cr_entry_10ohm",     MODE_CR, 0,       10,      12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cr_step_10_4ohm",    MODE_CR, 10,      4,       12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cr_line_12_9V",      MODE_CR, 10,      10,      12.0,   9.0,    60,     3,        4,     0,    0},
+  {"cp_entry_10W",       MODE_CP, 0,       10000,   12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cp_step_10_20W",     MODE_CP, 10000,   20000,   12.0,   12.0,   60,     3,        4,     0,    0},
+  {"cp_line_12_9V",      MODE_CP, 10000,   10000,   12.0,   9.0,    60,     3,        4,     0,    0},
+  //Remote sense: the targets are at the device, 0.1 ohm leads would put a local reading 5% off
+  {"cr_step_4ohm_leads", MODE_CR, 10,      4,       12.0,   12.0,   60,     3,        4,     0,    0.1},
+  {"cp_step_30W_leads",  MODE_CP, 10000,   30000,   12.0,   12.0,   60,     3,        4,     0,    0.1},
+  //CV: setpoints in mV, settling and overshoot on the input voltage. The source resistance sets the loop gain.
+  //On a stiff source the ADC noise (~4mV) moves the current by 4mV / Rs, hence the ripple limit at 0.5 ohm.
+  //CV settles over a fixed number of pairs, the 100kHz bus (I2C_CLOCK) gives ~20% fewer than fast mode.
+  {"cv_entry_10V_2ohm",  MODE_CV, 0,       10000,   12.0,   12.0,   200,    3,        4,     2.0,  0},
+  {"cv_step_10_8V_2ohm", MODE_CV, 10000,   8000,    12.0,   12.0,   200,    3,        4,     2.0,  0},
+  {"cv_line_12_14V_2ohm",MODE_CV, 10000,   10000,   12.0,   14.0,   200,    3,        4,     2.0,  0},
+  {"cv_entry_11V_0.5ohm",MODE_CV, 0,       11000,   12.0,   12.0,   200,    3,        8,     0.5,  0},
+  {"cv_entry_10V_10ohm", MODE_CV, 0,       10000,   12.0,   12.0,   200,    3,        4,     10.0, 0},
+  {"cv_entry_10V_30ohm", MODE_CV, 0,       10000,   12.0,   12.0,   200,    3,        4,     30.0, 0},
+};
+
+struct Result {
+  double blocked_pct;
+  double settle_ms;             //negative if it never settled
+  double overshoot_pct;
+  double ripple_lsb;
+  double target_mA;
+  double final_mA;
+  double target_V;
+  double final_V;
+};
+
+
+//The regulated quantity: the voltage of the device in CV, the current in the other modes
+static double regulated(int mode)
+{
+  return mode == MODE_CV ? sim_device_voltage() : sim_current();
+}
+
+//Current the load should end up drawing, from the source model
+static double target_current(int mode, double setpoint, double vs, double rs)
+{
+  switch(mode){
+    case MODE_CC: return setpoint / 1000.0;
+    case MODE_CV: return vs > setpoint / 1000.0 ? (vs - setpoint / 1000.0) / rs : 0;
+    case MODE_CR: return vs / (setpoint + rs);
+    default: {                  //I * (Vs - I * Rs) = P
+      double p = setpoint / 1000.0;
+      if(rs <= 0) return p / vs;
+      return (vs - sqrt(vs * vs - 4 * rs * p)) / (2 * rs);
+    }
+  }
+}
+
+static void set_setpoint(int mode, float value)
+{
+  if(mode == MODE_CR) ohm_setpoint = (long)value;
+  if(mode == MODE_CC) mA_setpoint = (long)value;
+  if(mode == MODE_CP) mW_setpoint = (long)value;
+  if(mode == MODE_CV) mV_setpoint = (long)value;
+}
+
+//Same as finishing the setpoint entry in the menu
+static void enter_mode(int mode, float setpoint)
+{
+  set_setpoint(mode, setpoint);
+  Menu_level = mode;
+  pause = false;
+  pid_bumpless(regulator, 0);
+  cv_start(0);
+}
+
+static void run_until(uint64_t t)
+{
+  while(sim_time_us() < t) sim_run_loop();
+}
+
+static Result run_scenario(const Scenario &sc)
+{
+  SimConfig config = sim_default_config();
+  config.source_v = sc.source_before;
+  if(sc.source_r > 0) config.source_r = sc.source_r;
+  config.lead_r = sc.lead_r;
+  config.sense = sc.lead_r > 0 ? SIM_SENSE_REMOTE : SIM_SENSE_LOCAL;
+  sim_eeprom_erase();                   //every scenario starts from the defaults, not what the last one saved
+  sim_reset(config);
+  remote_mode(1);                       //main menu, not still in the mode of the scenario before
+  setup();
+  set_remote_sense(sc.lead_r > 0);
+  run_until(BOOT_US);                   //start up tune, splash and LCD set up are over, like a user at the menu
+
+  if(sc.setpoint_before > 0){
+    enter_mode(sc.mode, sc.setpoint_before);
+    run_until(sim_time_us() + PRE_STEP_US);
+    set_setpoint(sc.mode, sc.setpoint_after);
+  }
+  else{
+    enter_mode(sc.mode, sc.setpoint_after);
+  }
+  sim_config().source_v = sc.source_after;
+
+  double target_i = target_current(sc.mode, sc.setpoint_after, sc.source_after, sim_config().source_r);
+  double target = sc.mode == MODE_CV ? sc.setpoint_after / 1000.0 : target_i;
+  double direction = target >= regulated(sc.mode) ? 1 : -1;
+  uint64_t step_us = sim_time_us();
+  uint64_t end_us = step_us + WINDOW_US;
+  uint32_t loops_at_step = sim_stats().loops;
+
+  uint64_t last_outside_us = step_us;
+  bool ever_inside = false;
+  double peak = 0;
+  int dac_min = 4096, dac_max = -1;
+
+  while(sim_time_us() < end_us){
+    sim_run_loop();
+    double i = regulated(sc.mode);
+    if(fabs(i - target) > target * SETTLE_BAND){
+      last_outside_us = sim_time_us();
+    }
+    else{
+      ever_inside = true;
+    }
+    double beyond = (i - target) * direction;
+    if(beyond > peak) peak = beyond;
+    if(sim_time_us() >= end_us - RIPPLE_US){
+      int dac = sim_dac_code();
+      if(dac < dac_min) dac_min = dac;
+      if(dac > dac_max) dac_max = dac;
+    }
+  }
+
+  Result r;
+  double busy_us = (double)(sim_stats().loops - loops_at_step) * sim_config().loop_us;
+  r.blocked_pct = busy_us < WINDOW_US ? (1 - busy_us / WINDOW_US) * 100.0 : 0;
+  bool settled = ever_inside && last_outside_us < end_us - RIPPLE_US;
+  r.settle_ms = settled ? (last_outside_us - step_us) / 1000.0 : -1;
+  r.overshoot_pct = target > 0 ? peak / target * 100.0 : 0;
+  r.ripple_lsb = dac_max - dac_min;
+  r.target_mA = target_i * 1000.0;
+  r.final_mA = sim_current() * 1000.0;
+  r.target_V = sc.mode == MODE_CV ? target : sc.source_after - target_i * sim_config().source_r;
+  r.final_V = sim_device_voltage();
+  return r;
+}
+
+//cal_apply_fine() against the exact rounded (fine * num) >> (shift + FINE_SHIFT), over the ADC range, the
+//calibration range (num < 65536) and the shifts read_measurement() uses: 14 for the volts and mA, 4 for the
+//current in Q10. Returns the number of results that differ.
+static int fixed_point_errors()
+{
+  static const uint8_t shifts[] = {14, 4};
+  static const int32_t nums[] = {1, 3072, 33800, 40961, 65535};
+  int errors = 0;
+  for(uint8_t shift : shifts)
+    for(int32_t num : nums)
+      for(int32_t fine = -32768L * (1 << FINE_SHIFT); fine < 32768L * (1 << FINE_SHIFT); fine += 37){
+        int64_t exact = ((int64_t)fine * num + ((int64_t)1 << (shift + FINE_SHIFT - 1))) >> (shift + FINE_SHIFT);
+        if(cal_apply_fine(fine, num, shift) != exact) errors++;
+      }
+  return errors;
+}
+
+static bool passes(const Scenario &sc, const Result &r)
+{
+  return r.settle_ms >= 0 && r.settle_ms <= sc.max_settle_ms
+      && r.overshoot_pct <= sc.max_overshoot_pct
+      && r.ripple_lsb <= sc.max_ripple_lsb
+      && r.blocked_pct <= MAX_BLOCKED_PCT;
+}
+
+int main(int argc, char **argv)
+{
+  bool report_only = argc > 1 && !strcmp(argv[1], "-n");
+  int count = sizeof(scenarios) / sizeof(scenarios[0]);
+  int fixed_point = fixed_point_errors();
+  bool all_pass = fixed_point == 0;
+
+  printf("{\n  \"fixed_point_errors\": %d,\n  \"scenarios\": [\n", fixed_point);
+  for(int n = 0; n < count; n++){
+    const Scenario &sc = scenarios[n];
+    Result r = run_scenario(sc);
+    bool pass = passes(sc, r);
+    all_pass = all_pass && pass;
+    printf("    {\"name\": \"%s\", \"blocked_pct\": %.2f, \"settle_ms\": %.2f, \"overshoot_pct\": %.2f, "
+           "\"ripple_lsb\": %.0f, \"target_mA\": %.1f, \"final_mA\": %.1f, \"target_V\": %.3f, \"final_V\": %.3f, "
+           "\"limits\": {\"settle_ms\": %.1f, \"overshoot_pct\": %.1f, \"ripple_lsb\": %.0f, \"blocked_pct\": %.1f}, "
+           "\"pass\": %s}%s\n",
+           sc.name, r.blocked_pct, r.settle_ms, r.overshoot_pct, r.ripple_lsb, r.target_mA, r.final_mA, r.target_V, r.final_V,
+           sc.max_settle_ms, sc.max_overshoot_pct, sc.max_ripple_lsb, MAX_BLOCKED_PCT,
+           pass ? "true" : "false", n + 1 < count ? "," : "");
+  }
+  printf("  ],\n  \"pass\": %s\n}\n", all_pass ? "true" : "false");
+
+  return (all_pass || report_only) ? 0 : 1;
+}
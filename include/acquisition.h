@@ -0,0 +1,86 @@
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <Arduino.h>
+#include "measure.h"
+
+/////////////////////////////ADS1115 acquisition engine//////////////////////////////////
+/*The ADS1115 is kept converting all the time, alternating the input mux between the current shunt (AIN0-AIN1
+  differential) and the voltage: AIN2 alone, or AIN2-AIN3 differential with remote sense (sense.h). It runs from interrupts: the falling edge of ALERT/RDY at the
+  end of a conversion queues the start of the next one and then the read of the finished result (it stays in
+  the conversion register until the next conversion ends), so the converter is only idle for one config
+  write and loop() never waits for anything. Call acq_poll() on every pass of loop(); when it returns true a
+  new current/voltage pair is ready in acq_latest().
+
+  The heatsink NTC (A6, thermal.h) and the load terminals (A7, sense.h) are read by the ATmega's own 10 bit ADC,
+  started and collected by acq_poll() without waiting (104us a conversion): the NTC after every ACQ_TEMP_PAIRS
+  pairs, about three times a second, the terminals after every ACQ_TERMINAL_PAIRS (if wired). The ADS1115 converts
+  nothing but the current and the voltage.
+
+  Auto-ranging: the current and the voltage channel each have their own PGA range, picked for the next
+  conversion of that channel from its last result. One range finer when the result would be under
+  ACQ_RANGE_UP counts in it, one range coarser when it is over ACQ_RANGE_DOWN counts in the range in use; the
+  gap between the two is the hysteresis, so a steady input never flips between ranges. A result at the end of
+  its range (clipped) is thrown away with its pair and the channel goes straight back to the coarsest range,
+  so a clipped value never reaches the protection, the filters or the regulation: the pair comes one pair
+  later.
+
+  Every result is handed over in fine counts, 1/2^FINE_SHIFT of a GAIN_TWOTHIRDS count (measure.h), through a
+  scale per range: the nominal PGA ratio (exact to 0.001%) corrected by the range's trim. Trims are parts in
+  2^15 relative to the coarsest range, which has none: the calibrations of main.cpp (CAL:CURR, CAL:VOLT) hold
+  the shunt and the divider, the trims (CAL:CURR:RANG, CAL:VOLT:RANG) the gain error of each finer range. */
+
+//Default data rate. Any RATE_ADS1115_xxSPS value from ads1115.h works, 860SPS is the fastest.
+#define ACQ_DATA_RATE   RATE_ADS1115_860SPS
+
+//Arduino pin wired to the ADS1115 ALERT/RDY output (D2 = INT0, free on the board). Set it to -1 if the pin is
+//not wired, acq_poll() then collects each result once the worst case conversion time has passed.
+#define ACQ_RDY_PIN     2
+
+#define ACQ_TEMP_PAIRS      128
+#define ACQ_TERMINAL_PAIRS  4         //~9ms
+#define ACQ_NTC_INPUT       6         //A6
+//Analog input wired to the load terminals through the open lead divider (sense.h). Set it to -1 on a board
+//without that divider: the terminals are then never read and the open lead check is left out.
+#define ACQ_TERMINAL_INPUT  7         //A7
+
+#define ACQ_CURRENT     0             //channels for the range functions
+#define ACQ_VOLTAGE     1
+#define ACQ_RANGES      6             //0 = GAIN_TWOTHIRDS (+/-6.144V) ... 5 = GAIN_SIXTEEN (+/-0.256V)
+#define ACQ_RANGE_UP    20000         //counts a result has to stay under in the next finer range to go there
+#define ACQ_RANGE_DOWN  28000         //counts over which the next conversion is one range coarser
+#define ACQ_TRIM_MAX    1000          //largest trim, about 3%
+#define ACQ_TRIM_COUNTS 8000          //counts in the range a reading must have to work out a trim from
+#define ACQ_OVERRANGE   (32000L << FINE_SHIFT)    //fine counts treated as a floating input
+
+struct AcqSample {
+  int32_t current;            //AIN0-AIN1 differential (shunt), fine counts
+  int32_t voltage;            //AIN2 single ended (divider) or AIN2-AIN3 (remote sense), fine counts
+  int16_t current_raw;        //the ADS1115 counts they came from, in their range
+  int16_t voltage_raw;
+  uint8_t current_range;      //0 .. ACQ_RANGES - 1
+  uint8_t voltage_range;
+  unsigned long stamp_us;     //micros() when the pair was completed
+  uint16_t seq;               //incremented on every new pair
+};
+
+void acq_begin();                           //configure the ADC and start the first conversion
+void acq_set_data_rate(uint16_t rate);      //RATE_ADS1115_xxSPS, takes effect on the next conversion
+bool acq_poll();                            //never blocks, true when a new pair arrived since the last call
+void acq_latest(AcqSample &sample);         //copy of the last complete pair
+bool acq_temperature(int16_t &raw);         //last A6 counts (10 bit), true when new since the last call
+bool acq_terminal(int16_t &raw);            //the same for A7, never new with ACQ_TERMINAL_INPUT -1
+void acq_set_remote(bool remote);           //voltage from AIN2-AIN3 instead of AIN2, from the next pair on
+bool acq_remote();
+uint8_t acq_range(uint8_t channel);         //range of that channel's last result
+void acq_set_trim(uint8_t channel, uint8_t range, int16_t trim);   //range 1 .. ACQ_RANGES - 1, clamped to ACQ_TRIM_MAX
+int16_t acq_trim(uint8_t channel, uint8_t range);
+bool acq_calibrate(uint8_t channel, int32_t actual, int32_t measured);  //trim the channel's range in use so
+                                                                        //measured reads actual, false in range 0
+
+//Hardware layer of the ATmega's ADC, implemented by its registers on AVR and by the simulator on the host.
+void acq_hw_aux_start(uint8_t input);       //start a conversion of ADC input 0-7 against AVcc
+bool acq_hw_aux_busy();
+uint16_t acq_hw_aux_result();
+
+#endif
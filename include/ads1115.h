@@ -0,0 +1,62 @@
+#ifndef ADS1115_H
+#define ADS1115_H
+
+#include <Arduino.h>
+#include "i2c_bus.h"
+
+/////////////////////////////ADS1115 driver on the I2C scheduler//////////////////////////////////
+/*Register level driver. A conversion is one config write (single shot, the new mux always applies) and the
+  result is one pointer write + 2 byte read; both go out on the high priority queue and report back through
+  their callbacks. ALERT/RDY is put in conversion ready mode once in begin(), so it goes low at the end of
+  every conversion. */
+
+#define ADS1115_ADDRESS           0x48
+
+#define ADS1115_MUX_DIFF_0_1      0x0000
+#define ADS1115_MUX_DIFF_0_3      0x1000
+#define ADS1115_MUX_DIFF_1_3      0x2000
+#define ADS1115_MUX_DIFF_2_3      0x3000
+#define ADS1115_MUX_SINGLE_0      0x4000
+#define ADS1115_MUX_SINGLE_1      0x5000
+#define ADS1115_MUX_SINGLE_2      0x6000
+#define ADS1115_MUX_SINGLE_3      0x7000
+
+#define GAIN_TWOTHIRDS            0x0000    //+/-6.144V
+#define GAIN_ONE                  0x0200    //+/-4.096V
+#define GAIN_TWO                  0x0400    //+/-2.048V
+#define GAIN_FOUR                 0x0600    //+/-1.024V
+#define GAIN_EIGHT                0x0800    //+/-0.512V
+#define GAIN_SIXTEEN              0x0A00    //+/-0.256V
+
+#define RATE_ADS1115_8SPS         0x0000
+#define RATE_ADS1115_16SPS        0x0020
+#define RATE_ADS1115_32SPS        0x0040
+#define RATE_ADS1115_64SPS        0x0060
+#define RATE_ADS1115_128SPS       0x0080
+#define RATE_ADS1115_250SPS       0x00A0
+#define RATE_ADS1115_475SPS       0x00C0
+#define RATE_ADS1115_860SPS       0x00E0
+
+class Ads1115 {
+public:
+  void begin(uint8_t address = ADS1115_ADDRESS);    //waits for the bus, call from setup()
+  void setGain(uint16_t gain) { gain_bits = gain; }
+  uint16_t getGain() { return gain_bits; }
+  void setDataRate(uint16_t rate) { rate_bits = rate; }
+  uint16_t getDataRate() { return rate_bits; }
+
+  bool startConversion(uint16_t mux, I2cCallback started = 0);   //queue a single shot conversion
+  bool readConversion(I2cCallback done);                         //queue a read of the last result
+  int16_t lastResult();                                          //valid in/after the readConversion callback
+
+private:
+  void writeRegister(uint8_t reg, uint16_t value);
+  uint8_t address;
+  uint16_t gain_bits = GAIN_TWOTHIRDS;
+  uint16_t rate_bits = RATE_ADS1115_128SPS;
+  I2cTransaction start_txn;
+  I2cTransaction read_txn;
+  uint8_t result[2];
+};
+
+#endif
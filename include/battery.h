@@ -0,0 +1,29 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <Arduino.h>
+
+/////////////////////////////Battery discharge test//////////////////////////////////
+/*Constant current discharge down to a cutoff voltage, counting charge and energy. Every current/voltage pair
+  is integrated over the time since the previous one, using the ADC timestamps, into 64 bit counters (charge in
+  mA*us, energy in uW*us), so nothing is lost to rounding however long the test runs: the energy counter only
+  fills up after 5 kWh.
+
+  The cutoff is checked on every pair, not on the LCD refresh. BATT_TRIP_SAMPLES pairs in a row below the
+  cutoff end the test (one noisy sample does not). A battery recovers once the load is off, so resuming is
+  only allowed once it is back above cutoff + BATT_HYSTERESIS_mV; otherwise the load would chatter on and off
+  around the cutoff. */
+
+#define BATT_HYSTERESIS_mV   100
+#define BATT_TRIP_SAMPLES    4          //~12ms at 330 pairs/s
+#define BATT_DEFAULT_CUTOFF  3000       //mV, one Li-ion cell
+
+void batt_start();                                      //clear the counters, arm the cutoff
+bool batt_sample(unsigned long stamp_us, long mA, long mV, long cutoff_mV, bool load_on);  //false once the cutoff is reached
+bool batt_ended();
+bool batt_can_resume(long mV, long cutoff_mV);          //above the cutoff plus hysteresis: clears the end
+uint32_t batt_uAh();
+uint32_t batt_uWh();
+uint32_t batt_seconds();                                //time the load was on
+
+#endif
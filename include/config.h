@@ -0,0 +1,55 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+#include "acquisition.h"
+
+/////////////////////////////Settings kept across power cycles//////////////////////////////////
+/*Calibration, I2C addresses, the mode that was running and every setpoint and limit, restored at boot.
+
+  The record goes round CONFIG_SLOTS slots in turn (wear levelling: each slot is written once every
+  CONFIG_SLOTS saves), each with a sequence number and a CRC, so the newest valid one wins at boot. A save cut
+  short by a power loss leaves a bad CRC in its slot and the one before it is used. A record with another
+  CONFIG_VERSION is ignored, so a firmware with a different layout starts from the defaults.
+
+  config_poll() gets a fresh copy every CONFIG_CHECK_MS (config_due()) and saves it once it has stayed the same
+  for CONFIG_SAVE_MS, so turning the encoder through a setpoint costs one save, not one per step. The bytes go
+  through the background writer (nvm.h): config_write() tops the queue up on every pass but leaves NVM_RESERVE
+  bytes free, so a command that saves (LIST:STEP) finds room and never waits the ~0.4s a slot takes.
+
+  EEPROM format of a slot at CONFIG_EEPROM_ADDR + n * CONFIG_SLOT_BYTES:
+    0       CONFIG_VERSION
+    1       sequence number, uint16 little endian, +1 per save
+    3       Config as laid out in RAM (AVR: packed, little endian)
+    3 + len CRC-16/CCITT-FALSE of bytes 0 .. 2 + len */
+
+#define CONFIG_EEPROM_ADDR  0x000
+#define CONFIG_SLOTS        4
+#define CONFIG_SLOT_BYTES   112         //0x000 - 0x1BF
+#define CONFIG_VERSION      3           //2: ADC range trims, 3: remote sense
+#define CONFIG_CHECK_MS     100
+#define CONFIG_SAVE_MS      2000
+
+struct Config {
+  int32_t current_num;        //calibrations, see measure.h (the shift is fixed)
+  int32_t voltage_num;
+  int32_t sense_num;          //voltage calibration with remote sense (sense.h)
+  int32_t ohm, mA, mW, mV;    //CR, CC, CP and CV setpoints
+  int32_t batt_cutoff_mV;
+  int32_t dyn_level1_mA, dyn_level2_mA, dyn_freq_mHz, dyn_duty, dyn_slew;
+  int32_t ocp_mA, opp_mW, uvp_mV, ovp_mV;     //protection limits (protect.h)
+  int16_t current_trim[ACQ_RANGES - 1];       //trims of ADC ranges 1 .. 5 (acquisition.h)
+  int16_t voltage_trim[ACQ_RANGES - 1];
+  uint8_t lcd_address;
+  uint8_t dac_address;
+  uint8_t mode;               //Menu_level of the mode that was running, 1 = none
+  uint8_t remote_sense;       //1 = voltage from AIN2-AIN3
+};
+
+bool config_load(Config &config);     //newest valid record, false when there is none (config untouched)
+bool config_due();                    //time to pass config_poll() a fresh copy
+void config_poll(const Config &config);
+void config_write();                  //call every pass of loop(), feeds a save to the EEPROM queue
+bool config_saving();                 //a save is being written
+
+#endif
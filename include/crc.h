@@ -0,0 +1,33 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <Arduino.h>
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+/////////////////////////////CRC-16/CCITT-FALSE//////////////////////////////////
+/*Poly 0x1021, MSB first, start from 0xFFFF. Shared by the telemetry frames (telemetry.h) and the settings
+  records in the EEPROM (config.h), so a host tool checks both with the same routine. */
+
+static inline uint16_t crc_update(uint16_t crc, uint8_t value)
+{
+#ifdef __AVR__
+  return _crc_xmodem_update(crc, value);         //poly 0x1021, MSB first
+#else
+  crc ^= (uint16_t)value << 8;
+  for(uint8_t i = 0; i < 8; i++){
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+#endif
+}
+
+static inline uint16_t crc_block(uint16_t crc, const void *data, uint8_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while(len--) crc = crc_update(crc, *p++);
+  return crc;
+}
+
+#endif
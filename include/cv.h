@@ -0,0 +1,37 @@
+#ifndef CV_H
+#define CV_H
+
+#include <Arduino.h>
+
+/////////////////////////////Constant voltage mode//////////////////////////////////
+/*The load sinks whatever current holds the input at the setpoint. cv_update() turns the voltage error into a
+  target current for the regulator (regulator.h), so the CC loop, its feed-forward and the current limit are
+  the same as in the other modes.
+
+  The voltage moves by the source resistance times the current change, which can be anything from 0.05 ohm
+  (a bench supply) to hundreds of ohms (a charger in its current limit, a solar panel near short circuit),
+  so a fixed gain is either unstable on one end or takes seconds on the other. Instead the step is the error
+  divided by the source resistance, and the resistance is measured as the load moves: every time the current
+  has changed by CV_R_STEP_mA (or the voltage by CV_R_STEP_mV), -dV/dI over that change is a new estimate.
+  A higher estimate is taken at once (lower gain is always safe), a lower one at most a factor 4 at a time so
+  noise can not make the loop unstable.
+
+  A run starts with a probe: the current doubles from CV_PROBE_mA every CV_PROBE_SAMPLES samples until the
+  first estimate comes in or the input is down to the setpoint, then the loop takes over. */
+
+#define CV_GAIN           32        //Q8, part of the error corrected per sample (0.125)
+#define CV_R_START_mohm   100000UL  //used until the first measurement
+#define CV_R_MIN_mohm     50UL
+#define CV_R_MAX_mohm     1000000UL //1 kohm
+#define CV_R_STEP_mA      50        //current change between two estimates...
+#define CV_R_STEP_mV      100       //...or voltage change, on a soft source
+#define CV_R_MIN_STEP_mA  2         //with at least this much current change
+#define CV_PROBE_mA       2         //first probe current, doubled every CV_PROBE_SAMPLES
+#define CV_PROBE_SAMPLES  4
+#define MAX_SETPOINT_mV   65000     //top of the setpoint range, under the 67V full scale of the voltage divider
+
+void cv_start(long mA);                                 //new run from `mA`, resistance unknown
+long cv_update(long setpoint_mV, long mV, long mA);     //target current in mA, call once per sample
+uint32_t cv_resistance();                               //source resistance estimate in mohm
+
+#endif
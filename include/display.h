@@ -0,0 +1,34 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <Arduino.h>
+#include "lcd.h"
+
+/////////////////////////////Framebuffer for the 16x2 LCD//////////////////////////////////
+/*The menus draw a whole frame into RAM (clear, setCursor, print, write work like on the LCD but send nothing).
+  refresh() compares the frame with a shadow copy of what the LCD shows and queues only the cells that changed,
+  moving the cursor only when it saves bytes. It never waits: it stops when the LCD queue is full and carries
+  on where it stopped on the next call, so calling it on every loop() pass lets the frame trickle out on the
+  low priority I2C queue in the background. */
+
+#define DISPLAY_COLS  16
+#define DISPLAY_ROWS  2
+
+class FrameBuffer : public Print {
+public:
+  FrameBuffer(Lcd &lcd);
+  void clear();                           //blank the frame, nothing is sent
+  void setCursor(uint8_t col, uint8_t row);
+  virtual size_t write(uint8_t value);
+  void invalidate();                      //clear the LCD and start again from a known state
+  bool refresh();                         //queue what fits, true when the LCD matches the frame
+
+private:
+  Lcd &lcd;
+  uint8_t frame[DISPLAY_ROWS][DISPLAY_COLS];
+  uint8_t shown[DISPLAY_ROWS][DISPLAY_COLS];
+  uint8_t col, row;                       //write position in the frame
+  int8_t lcd_col, lcd_row;                //LCD cursor, -1 when unknown
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef DYNAMIC_H
+#define DYNAMIC_H
+
+#include <Arduino.h>
+
+/////////////////////////////Dynamic (transient) load//////////////////////////////////
+/*The load switches between two currents at a set frequency and duty cycle. The edges come from the 1ms timer
+  interrupt (tick.h), which writes the DAC itself, so their timing does not depend on loop(). Level 1 is on
+  for the first duty% of each period, level 2 for the rest. With a slew rate set, the interrupt ramps the DAC
+  towards the new level by a fixed step every millisecond instead of jumping.
+
+  The interrupt only knows one DAC code per level. Those start from the calibrated feed-forward (feedforward.h) and are trimmed from loop() by one PI regulator per level, with the same gains as CC mode:
+  every current sample taken while a level has been steady for DYN_SETTLE_MS corrects that level's code. A
+  level must therefore last longer than DYN_SETTLE_MS plus one sample for its trim to move. */
+
+#define DYN_SETTLE_MS     8           //DAC write + load lag + a whole current/voltage pair, before a sample counts
+#define DYN_MIN_PERIOD_MS 2
+#define DYN_MAX_FREQ_mHz  (1000000L / DYN_MIN_PERIOD_MS)
+
+void dyn_start();                   //reset the trims and start the timer
+void dyn_stop();                    //stop the timer, the caller sets the DAC
+//Call every pass, it only touches the interrupt's settings when something changed. slew 0 = step at once.
+void dyn_configure(long level1_mA, long level2_mA, long freq_mHz, uint8_t duty, long slew_mA_per_ms, bool on);
+void dyn_trim(long measured_mA);    //call with every new current sample
+
+#endif
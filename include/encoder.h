@@ -0,0 +1,20 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <Arduino.h>
+
+/////////////////////////////Rotary encoder//////////////////////////////////
+/*CLK on D10 (PB2) and DT on D9 (PB1), decoded in the pin change interrupt with a 16 entry table indexed by
+  the previous and the new 2 bit state. Transitions that skip a state (both pins changed, a bounce we missed)
+  count as nothing, and a bounce back and forth cancels itself. The encoder has a detent every two
+  transitions, so two valid transitions in the same direction make one step.
+
+  The interrupt only bumps a one byte tick counter, which the AVR reads in one instruction, so the main loop
+  picks the steps up with encoder_read() without turning interrupts off. The loop owns its own position
+  variable (reset, clamped, ...) and adds the steps to it; anything slow such as the click sound is done there
+  and never in the interrupt. */
+
+void encoder_begin();           //pins as inputs and pin change interrupt on
+int8_t encoder_read();          //steps since the last call, + is clockwise
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef FEEDFORWARD_H
+#define FEEDFORWARD_H
+
+#include <Arduino.h>
+
+/////////////////////////////DAC to current calibration//////////////////////////////////
+/*A piecewise linear table of the load current at FF_POINTS DAC codes (every 256 codes, and 4095), measured
+  by a sweep. ff_dac() turns it around: the DAC code that should give a current. The modes jump straight to
+  that code on every setpoint or line change (pid_feed_forward(), regulator.h) so the PID only has to take
+  out what the table gets wrong.
+
+  The sweep needs a supply on the input that can deliver the full current: a low voltage (2-5V) keeps the
+  MOSFET dissipation down. It steps the DAC through the table codes, waits FF_SETTLE_SAMPLES samples at each
+  one and averages the next FF_AVG_SAMPLES. It stops early when the voltage falls below FF_MIN_mV or the
+  current rises less than half as much as in the step before (the supply has reached its limit), or when the
+  current passes MAX_SETPOINT_mA; the points it did not reach are extrapolated from the last two. The table is saved in the EEPROM; without one the nominal gain is used
+  (4096 codes for 5000mA: 5V reference, 1 ohm shunt).
+
+  EEPROM format at FF_EEPROM_ADDR: FF_MAGIC, number of measured points, then FF_POINTS currents in mA
+  (2 bytes each, little endian). */
+
+#define FF_EEPROM_ADDR      0x1C0
+#define FF_MAGIC            0xCA
+#define FF_POINTS           17
+#define FF_SETTLE_SAMPLES   4
+#define FF_AVG_SAMPLES      16
+#define FF_MIN_mV           1000
+
+#define FF_IDLE             0
+#define FF_SWEEP            1
+#define FF_SAVE             2           //measured, being written to the EEPROM
+#define FF_DONE             3
+#define FF_FAIL             4           //not enough current (no supply?), the old table is kept
+
+void ff_begin();                        //load the table from the EEPROM, call once in setup()
+int16_t ff_dac(long mA);                //DAC code for a current, no division
+int16_t ff_dac_step(long mA, long delta_mA);    //DAC codes for a change of delta_mA just below mA, slope only
+long ff_table(uint8_t point);           //mA at point `point`
+uint16_t ff_code(uint8_t point);        //its DAC code
+bool ff_calibrated();                   //false while the nominal table is used
+void ff_clear();                        //back to the nominal table, erased from the EEPROM as well
+
+void ff_sweep_start();                  //writes the DAC itself until it ends
+void ff_sweep_stop();                   //abort, the load goes off and the old table comes back
+void ff_sweep_sample(long mA, long mV); //call with every new sample while sweeping
+void ff_poll();                         //call every pass of loop(), saves the new table
+uint8_t ff_status();
+uint8_t ff_point();                     //point being measured, or measured points once done
+
+#endif
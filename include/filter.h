@@ -0,0 +1,51 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <Arduino.h>
+
+/////////////////////////////ADC sample filters//////////////////////////////////
+/*Sits between the acquisition engine and the regulation, one Filter per channel of fine ADC counts (int32,
+  the same unit in every PGA range, see acquisition.h), so a range change inside the window needs nothing.
+  Every sample goes through:
+    median      of the last `median` samples (1 = off, 3 or 5): a single spike never reaches the regulator
+    average     of the last 2^average_shift samples (0 = off, up to 4 = 16 samples), a shift divides
+    decimate    false: every sample gives the running average. true: only every 2^average_shift-th sample
+                gives an output, the average of the block (a first order CIC), so the regulator runs slower
+                on quieter samples.
+  Each stage adds lag (about half its length in samples), so the fast modes keep them short. All storage is
+  in the Filter itself, sized for the largest settings.
+
+  Smooth is the separate display channel: an exponential average of the converted values, much heavier than
+  what the regulator could live with, so the LCD digits stand still. */
+
+#define FILTER_MEDIAN_MAX     5
+#define FILTER_AVERAGE_MAX    16      //2^4
+#define SMOOTH_SHIFT          3       //display channel: each sample moves it 1/8 of the way
+
+struct FilterConfig {
+  uint8_t median;             //1, 3 or 5
+  uint8_t average_shift;      //0 to 4
+  bool decimate;
+};
+
+struct Filter {
+  FilterConfig config;
+  int32_t window[FILTER_MEDIAN_MAX];      //median input, oldest overwritten
+  uint8_t window_pos, window_fill;
+  int32_t history[FILTER_AVERAGE_MAX];    //average input
+  uint8_t history_pos, history_fill;
+  int32_t sum;                            //16 samples of up to 2^21
+};
+
+struct Smooth {
+  int32_t value;              //Q(SMOOTH_SHIFT)
+  bool primed;
+};
+
+void filter_init(Filter &f, const FilterConfig &config);      //also clears the history
+bool filter_push(Filter &f, int32_t raw, int32_t &out);       //true when `out` is a new output
+uint8_t filter_lag(const FilterConfig &config);               //outputs a step takes to come through, rounded up
+void smooth_reset(Smooth &s);
+long smooth_push(Smooth &s, long value);                      //returns the smoothed value
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+#include "profile.h"
+
+/////////////////////////////Interrupt driven I2C transaction scheduler//////////////////////////////////
+/*The LCD, the ADS1115 and the MCP4725 share one bus. Instead of Wire (which waits for every byte) the drivers
+  fill in an I2cTransaction and submit it; the TWI interrupt clocks it out and calls the transaction's callback
+  (from the interrupt) when it is done, or the caller can look at `status`. Nothing here waits.
+
+  There are two queues. Transactions on I2C_PRIO_HIGH (DAC writes, ADC starts and reads) always go before
+  anything on I2C_PRIO_LOW (LCD traffic). A transaction that already started is never interrupted, so the worst
+  case wait of a DAC write is one LCD transaction (7 bytes, ~0.63ms at 100kHz) plus the ADC traffic queued
+  ahead of it.
+
+  Transactions are owned by the driver that submits them (static storage, nothing is allocated) and must not
+  be touched while status is I2C_QUEUED or I2C_BUSY. */
+
+#define I2C_MAX_TX  6             //largest write: one LCD character is six expander bytes
+
+#define I2C_IDLE    0             //never submitted
+#define I2C_QUEUED  1
+#define I2C_BUSY    2             //on the bus right now
+#define I2C_DONE    3
+#define I2C_ERROR   4             //address or data not acknowledged
+
+#define I2C_PRIO_HIGH 0
+#define I2C_PRIO_LOW  1
+
+struct I2cTransaction;
+typedef void (*I2cCallback)(I2cTransaction &t);
+
+struct I2cTransaction {
+  uint8_t address;                //7 bit address
+  uint8_t tx_len;                 //bytes written first
+  uint8_t rx_len;                 //bytes read after a repeated start (0 for a plain write)
+  uint8_t tx[I2C_MAX_TX];
+  uint8_t *rx;                    //destination of the read bytes
+  I2cCallback done;               //called from the interrupt when finished, may be 0
+  volatile uint8_t status;
+  I2cTransaction *next;           //queue link, used by the scheduler
+#if PROFILE
+  uint16_t queued_us;             //low 16 bits of micros() when it was submitted
+#endif
+};
+
+void i2c_begin(uint32_t clock_hz);
+bool i2c_submit(I2cTransaction &t, uint8_t priority);   //false if t is still queued or busy
+bool i2c_pending(const I2cTransaction &t);              //queued or busy
+void i2c_wait(const I2cTransaction &t);                 //for setup code only: spins until t is finished
+void i2c_wait_idle();                                   //for setup code only: spins until both queues are empty
+
+//Hardware layer, implemented by the TWI interrupt on AVR and by the simulator on the host.
+void i2c_hw_begin(uint32_t clock_hz);
+void i2c_hw_start(I2cTransaction &t);                   //start clocking out t, the bus is idle
+void i2c_hw_finished(bool ok);                          //called by the hardware layer when t is done
+
+#endif
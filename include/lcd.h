@@ -0,0 +1,53 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include <Arduino.h>
+#include "i2c_bus.h"
+
+/////////////////////////////HD44780 LCD on a PCF8574 backpack//////////////////////////////////
+/*Drop-in for the parts of LiquidCrystal_I2C we use, on the I2C scheduler. Each character or command is one
+  low priority transaction of six expander bytes (data, data + enable, data for each nibble), so it can never
+  hold up the DAC or the ADC for longer than that one transaction.
+
+  write() and setCursor() queue and return; they only wait when all LCD_QUEUE_LEN transactions are in use, so
+  code that must never wait (the framebuffer) checks freeSlots() first. clear(), home() and createChar() wait
+  for the LCD to finish and are meant for setup().
+
+  begin() only starts the power up sequence (50ms, the 8 bit handshake, the custom characters): poll(), called
+  on every pass of loop(), sends each step once its wait is over. freeSlots() stays 0 until it is done, so the
+  framebuffer simply holds its frame until the LCD can take it and setup() does not wait ~70ms. */
+
+#define LCD_QUEUE_LEN  4
+
+class Lcd : public Print {
+public:
+  Lcd(uint8_t address, uint8_t cols, uint8_t rows);
+  void setAddress(uint8_t lcd_address) { address = lcd_address; }   //before begin()
+  void begin(const uint8_t (*chars)[8], uint8_t count);    //custom characters 0..count-1, the array must stay
+  void poll();
+  bool ready();
+  void backlight();
+  void noBacklight();
+  void clear();
+  void home();
+  void setCursor(uint8_t col, uint8_t row);
+  void createChar(uint8_t location, uint8_t charmap[]);
+  virtual size_t write(uint8_t value);
+  uint8_t freeSlots();
+
+private:
+  void send(uint8_t value, uint8_t mode);
+  void sendNibble(uint8_t nibble);      //8 bit mode handshake in poll()
+  I2cTransaction &slot();
+  uint8_t queueFree();
+  uint8_t address, rows;
+  uint8_t backlight_bit;
+  uint8_t next_slot;
+  const uint8_t (*custom)[8];
+  uint8_t custom_count;
+  uint8_t init_step;                    //power up step to send next, 0xFF before begin()
+  unsigned long init_start_us, init_wait_us;
+  I2cTransaction txn[LCD_QUEUE_LEN];
+};
+
+#endif
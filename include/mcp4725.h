@@ -0,0 +1,35 @@
+#ifndef MCP4725_H
+#define MCP4725_H
+
+#include <Arduino.h>
+#include "i2c_bus.h"
+
+/////////////////////////////MCP4725 driver on the I2C scheduler//////////////////////////////////
+/*setVoltage() queues the write on the high priority queue and returns. There are two transactions so a new
+  value can be queued while the previous one is on the bus; if a write is still waiting for the bus its value
+  is simply replaced, so the DAC always gets the newest code and the queue never grows.
+
+  Plain writes use the two byte fast write command (address + 2 bytes, 27 clocks instead of 36), and a code
+  that is already on the DAC or queued for it is not sent again, so the control loops can call setVoltage()
+  on every pass without loading the bus. Writes with writeEEPROM use the three byte command and always go.
+
+  shutdown() is for the protection (protect.h), also from an interrupt: it queues a 0 and turns every later
+  setVoltage() into a 0 until release(), so no mode or timer can switch the load back on behind its back. */
+
+class Mcp4725 {
+public:
+  void begin(uint8_t address);
+  void setVoltage(uint16_t output, bool writeEEPROM);
+  uint16_t lastValue() { return value; }    //last code passed to setVoltage() (0 while shut down)
+  void shutdown();
+  void release();                           //the DAC stays at 0 until the next setVoltage()
+
+private:
+  uint8_t address;
+  uint16_t value = 0;
+  uint16_t sent;                        //last code handed to the bus, 0xFFFF when unknown
+  volatile bool locked = false;         //shut down, every write is 0
+  I2cTransaction txn[2];
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include <Arduino.h>
+
+/////////////////////////////Fixed point measurement math//////////////////////////////////
+/*Everything between the ADC counts and the regulator is 32 bit integer: current in mA, voltage in mV, power
+  in mW. The AVR has no FPU, and a soft float multiply or divide costs more than the whole integer chain, so
+  float is only used to format numbers for the LCD.
+
+  Calibrations are a numerator and a shift: value = (raw * num) >> shift, rounded. Keep raw * num inside
+  31 bits (|raw| <= 32767, so num < 65536). Divisions by a value that rarely changes (the CR resistance) go
+  through a Reciprocal that is worked out once when the divisor changes.
+
+  The acquisition hands over fine counts (acquisition.h): 2^FINE_SHIFT of them per count of the GAIN_TWOTHIRDS
+  range the calibrations are written for, whatever PGA range the sample was taken in. cal_apply_fine() applies
+  the same num/shift to them without losing the extra bits. */
+
+#define FINE_SHIFT    5           //fine counts per GAIN_TWOTHIRDS count = 2^5 (5.86uV at the ADC pins)
+
+struct Reciprocal {
+  uint32_t divisor;           //the divisor num/shift were computed for
+  uint16_t num;               //x / divisor = (x * num) >> shift, num <= 2^15
+  uint8_t shift;
+};
+
+//Calibrated value from raw counts, rounded to nearest
+static inline int32_t cal_apply(int16_t raw, int32_t num, uint8_t shift)
+{
+  return ((int32_t)raw * num + ((int32_t)1 << (shift - 1))) >> shift;
+}
+
+//(fine * num) >> (shift + FINE_SHIFT), rounded. The whole counts and the fine bits are multiplied apart, so
+//the limit is the one of cal_apply(): |fine >> FINE_SHIFT| * num inside 31 bits. The result is exact for any
+//shift >= 1, FINE_SHIFT is added on top (read_measurement() takes the current in Q10 with shift 14 - 10 = 4).
+static inline int32_t cal_apply_fine(int32_t fine, int32_t num, uint8_t shift)
+{
+  int32_t whole = (fine >> FINE_SHIFT) * num;
+  int32_t part = ((fine & ((1 << FINE_SHIFT) - 1)) * num) >> FINE_SHIFT;
+  return (whole + part + ((int32_t)1 << (shift - 1))) >> shift;
+}
+
+//x / 1000 for |x| < 2^31 without a division, within 0.05% + 1 (used for mA * mV -> mW)
+static inline int32_t div1000(int32_t x)
+{
+  return ((x >> 10) * 1049 + 512) >> 10;
+}
+
+void recip_set(Reciprocal &r, uint32_t divisor);        //divisor > 0
+uint32_t recip_div(const Reciprocal &r, uint32_t x);    //x / divisor, x < 2^17
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MENU_H
+#define MENU_H
+
+#include <Arduino.h>
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
+
+/////////////////////////////Menu and mode state machine//////////////////////////////////
+/*Every Menu_level is a state with one row of handlers in a PROGMEM table indexed by the level, so finding
+  the state costs an index and a flash read, not a chain of compares:
+    enter     on the way in (from a button or the serial port)
+    exit      on the way out, before the next state's enter
+    input     every loop() pass: the encoder steps and button events, may call menu_event()
+    regulate  every new filtered current/voltage pair: the one place the DAC is driven from
+    draw      every LCD refresh period, into the framebuffer
+  Any of them may be 0. The ways out of a state are a second PROGMEM table of (state, event, next state)
+  rows, so the menu tree is data: a new mode is one row in each table plus its handlers.
+
+  The buttons are read once per loop() pass by menu_button(), which debounces them on millis() and gives one
+  event per push. The states never read the pins themselves. */
+
+#define MENU_DEBOUNCE_MS  5           //a button has to stay put this long, whatever the loop() pass rate
+
+//Events for the transition table
+#define MENU_BACK         0           //blue button
+#define MENU_DONE         1           //the state finished its entry (last digit, last row, run)
+#define MENU_EDIT         2           //second way out of a page (list editor)
+#define MENU_PICK         8           //main menu row n is MENU_PICK + n
+
+typedef void (*MenuHandler)();
+
+struct MenuState {
+  MenuHandler enter;
+  MenuHandler exit;
+  MenuHandler input;
+  MenuHandler regulate;
+  MenuHandler draw;
+};
+
+struct MenuTransition {
+  uint8_t from;
+  uint8_t event;
+  uint8_t to;
+};
+
+struct MenuButton {
+  uint8_t pin;
+  unsigned long since;        //millis() when the pin started to read differently from `down`
+  bool down;
+  bool changing;              //it reads differently, since `since`
+};
+
+//Both tables in PROGMEM. states[level] is the row of Menu_level `level`, levels past the end do nothing.
+void menu_begin(const MenuState *states, uint8_t state_count, const MenuTransition *transitions,
+                uint8_t transition_count, MenuHandler on_change);
+void menu_goto(int &level, uint8_t to);       //exit, on_change, level = to, enter
+bool menu_event(int &level, uint8_t event);   //follows the (level, event) row, false when there is none
+void menu_input(int level);
+void menu_regulate(int level);
+void menu_draw(int level);
+
+bool menu_button(MenuButton &button);         //true once per debounced push (active low, pin with pullup)
+
+#endif
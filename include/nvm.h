@@ -0,0 +1,35 @@
+#ifndef NVM_H
+#define NVM_H
+
+#include <Arduino.h>
+
+/////////////////////////////Background EEPROM writer//////////////////////////////////
+/*Writing one EEPROM byte takes 3.4ms and the usual EEPROM library waits for each one, which would stop the
+  regulation for tens of milliseconds on every save. Here writes are queued instead: nvm_poll(), called on
+  every pass of loop(), starts the next byte write whenever the EEPROM is free, and skips bytes that already
+  hold the value so saving the same data again costs no write cycles. nvm_read() also sees the bytes still in
+  the queue, so data reads back as written straight away. Writes reach the EEPROM in the order they were
+  queued: a byte still waiting only takes the new value when nothing but the same record was
+  queued after it.
+
+  EEPROM map (1024 bytes on the ATmega328P):
+    0x000 - 0x1BF   settings, 4 wear levelled slots (config.h)
+    0x1C0 - 0x1E3   DAC to current table (feedforward.h)
+    0x200 - 0x2C1   list mode steps (sequence.h) */
+
+#define NVM_QUEUE_LEN   32          //bytes waiting to be written, 3 bytes of RAM each
+#define NVM_RESERVE     16          //left free by the settings writer (config.h) for commands that save, a list
+                                    //step takes 14
+
+bool nvm_write(uint16_t address, const void *data, uint8_t len);   //all or nothing, false when there is no room
+void nvm_read(uint16_t address, void *data, uint8_t len);
+uint8_t nvm_free();                 //room left in the queue
+bool nvm_idle();                    //everything written
+void nvm_poll();                    //call every pass of loop()
+
+//Hardware layer, implemented by the EEPROM registers on AVR and by the simulator on the host.
+bool nvm_hw_ready();
+uint8_t nvm_hw_read(uint16_t address);
+void nvm_hw_write(uint16_t address, uint8_t value);   //only called when nvm_hw_ready()
+
+#endif
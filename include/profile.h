@@ -0,0 +1,55 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <Arduino.h>
+
+/////////////////////////////Loop and bus timing statistics//////////////////////////////////
+/*Each phase keeps the number of samples, min, mean and max in microseconds and a histogram with power of two
+  buckets: bucket 0 counts times below 8us, bucket n times from 4 * 2^n to 8 * 2^n us, the last one everything
+  from 8ms up. Times come from micros() (4us steps on a 16MHz AVR) and are clamped to 65535us. Recording is
+  a handful of compares and adds with interrupts off for a moment, so it can be left on; the report is read over
+  the serial port (PROFile commands in scpi.h).
+
+  Worst case control latency is PROF_CONTROL (ADC pair complete to the new code handed to the DAC driver)
+  plus PROF_DAC (from there until the MCP4725 transaction is finished).
+
+  With PROFILE 0 every call below compiles to nothing and the statistics take no RAM. */
+
+#define PROFILE         1           //0 to leave the instrumentation out (saves ~300 bytes of RAM)
+
+#define PROF_LOOP       0           //loop() period, start to start
+#define PROF_ADC        1           //acq_poll() and the filters at the top of loop()
+#define PROF_CONTROL    2           //ADC pair completed to the end of the regulation step that used it
+#define PROF_DAC        3           //MCP4725 write queued to written: waiting for the bus plus the transfer
+#define PROF_LCD        4           //display.refresh()
+#define PROF_BUTTONS    5           //encoder and pause button polling
+#define PROF_REMOTE     6           //SCPI parser, EEPROM writer and calibration save
+#define PROF_BUS        7           //every I2C transaction, first clock to finished
+#define PROF_PHASES     8
+
+#define PROF_BUCKETS    12
+
+struct ProfStat {
+  uint16_t count;                   //halved together with sum when it fills up, so the mean stays a mean
+  uint16_t min, max;
+  uint32_t sum;
+  uint16_t hist[PROF_BUCKETS];      //saturate at 65535
+};
+
+#if PROFILE
+inline unsigned long prof_start() { return micros(); }
+void prof_record(uint8_t phase, unsigned long us);
+void prof_end(uint8_t phase, unsigned long start);    //records micros() - start
+void prof_loop();                                     //call first thing in loop()
+void prof_get(uint8_t phase, ProfStat &stat);         //copy taken with interrupts off
+void prof_reset();
+#else
+inline unsigned long prof_start() { return 0; }
+inline void prof_record(uint8_t, unsigned long) {}
+inline void prof_end(uint8_t, unsigned long) {}
+inline void prof_loop() {}
+inline void prof_get(uint8_t, ProfStat &stat) { memset(&stat, 0, sizeof(stat)); }
+inline void prof_reset() {}
+#endif
+
+#endif
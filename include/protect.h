@@ -0,0 +1,47 @@
+#ifndef PROTECT_H
+#define PROTECT_H
+
+#include <Arduino.h>
+
+/////////////////////////////Over-current, over-power and input voltage protection//////////////////////////////////
+/*The limits are checked on every ADC result, in the interrupt that reads it (acquisition.cpp), against the
+  raw counts (brought to the GAIN_TWOTHIRDS range whatever range the result was taken in): the new current with
+  the last voltage, or the new voltage with the last current. A current clipped in a finer range is checked
+  at the full scale of that range, which trips OCP/OPP whenever the limit is under it. A clipped voltage is not
+  checked; the channel is converted in the coarsest range next, so OVP on a jump from a low range is one pair
+  later. A result past a limit turns the DAC off right there (the write goes out on the high priority queue,
+  ~0.1ms later), so a short or a runaway MOSFET is stopped within one conversion (1.2ms at 860SPS) however long
+  loop() or the LCD take. The DAC stays locked at 0 (Mcp4725::shutdown) whatever the modes write until the trip is acknowledged
+  with the red button or PROT:CLE; the mode stays paused after that, so the load only comes back on when the
+  user resumes it.
+
+  Under-voltage only trips while the DAC is on, so a load with nothing connected does not trip. The ALERT/RDY
+  pin of the ADS1115 is taken by the conversion ready signal, so its comparator can not do this job; the check
+  costs a few compares per result (plus two multiplies for the power). One result past a limit is enough: the
+  defaults leave room above the largest setpoints for the ADC noise. A limit of 0 turns that check off.
+  Without the ALERT/RDY wire (ACQ_RDY_PIN -1) results are collected from acq_poll(), so then the checks wait
+  for loop() like everything else. */
+
+#define PROTECT_OCP         0x01      //over-current, mA
+#define PROTECT_OPP         0x02      //over-power, mW
+#define PROTECT_UVP         0x04      //under-voltage, mV
+#define PROTECT_OVP         0x08      //over-voltage, mV
+#define PROTECT_OTP         0x10      //heatsink over-temperature, tripped by thermal.cpp
+#define PROTECT_SENSE       0x20      //voltage sense leads open or miswired, tripped by sense.cpp
+
+#define PROTECT_OCP_mA      5500      //defaults: MAX_SETPOINT_mA plus 10%, under the 6.1A ADC full scale
+#define PROTECT_OPP_mW      100000    //top of the CP range, lower it for a small heatsink
+#define PROTECT_UVP_mV      0         //off
+#define PROTECT_OVP_mV      60000     //under the 67V full scale of the divider
+
+//Calibrations of the two channels (measure.h), the limits are turned into raw counts with them
+void protect_begin(int32_t current_num, uint8_t current_shift, int32_t voltage_num, uint8_t voltage_shift);
+void protect_set(uint8_t which, long limit);      //one PROTECT_xxx, limit in mA, mW or mV, 0 = off
+long protect_limit(uint8_t which);
+void protect_check(int16_t current_raw, int16_t voltage_raw);   //from the acquisition interrupt
+void protect_trip(uint8_t cause);                 //latch `cause` and turn the DAC off, from anywhere
+uint8_t protect_tripped();                        //PROTECT_xxx bits latched since the last clear, 0 = none
+void protect_clear();                             //acknowledge: the DAC takes writes again
+const char *protect_name(uint8_t tripped);        //"OCP" ... for the first bit set, "" for none (in flash)
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef REGULATOR_H
+#define REGULATOR_H
+
+#include <Arduino.h>
+
+/////////////////////////////Fixed point PID regulator//////////////////////////////////
+/*One PID controller drives the DAC for every regulation mode. Each mode turns its own setpoint into a target
+  current in mA (CR: V/R, CC: the setpoint, CP: P/V), so a single set of gains works for all of them.
+  Gains are Q8 numbers in DAC LSB per mA (256 = 1 LSB/mA). The integrator is kept in Q8 DAC LSB and is
+  clamped to the DAC range, and it stops integrating while the output is saturated (anti-windup).
+
+  With pid_feed_forward() before each update the output follows the DAC code predicted for the target
+  (feedforward.h) at once, and the integrator only keeps the difference between that prediction and what
+  the load really needs. Changes of PID_FF_DEADBAND codes or less are ignored, so noise on a CR or CP
+  target does not go straight to the DAC. After a jump of more than PID_FF_JUMP codes the next few updates
+  only hold the output: those samples were converted before the load got there and would wind the integrator
+  up. That is PID_FF_HOLD samples plus the lag of the filters in front (pid_set_hold()). */
+
+#define PID_DAC_MIN     0
+#define PID_DAC_MAX     4095
+
+#define MAX_SETPOINT_mA 5000    //Target currents are clamped to this before they reach the regulator
+
+//Default gains, tuned with the regulation benchmark (bench/) for ~1.2 mA per DAC LSB (5V DAC reference,
+//1 ohm shunt) at 430 samples/s. Higher PID_KI overshoots because the current sample is one conversion old.
+#define PID_KP          16      //0.0625 LSB/mA
+#define PID_KI          72      //0.28 LSB/mA per sample
+#define PID_KD          0
+
+#define PID_FF_DEADBAND 4       //DAC codes, smaller feed-forward changes are left to the integrator
+#define PID_FF_JUMP     16      //DAC codes
+#define PID_FF_HOLD     3       //samples: each current sample is one conversion old, plus the load lag
+
+struct Pid {
+  int16_t kp, ki, kd;         //Q8 gains
+  int32_t integral;           //Q8 DAC LSB
+  int32_t prev_measured;      //for the derivative, which acts on the measurement to avoid setpoint kicks
+  bool restart;               //no derivative on the first update after a reset
+  int16_t out;                //last output (DAC code)
+  int16_t ff;                 //last feed-forward code, -1 after a reset
+  uint8_t hold;               //updates left that only hold the output after a feed-forward jump
+  uint8_t hold_samples;       //how many that is
+};
+
+void pid_init(Pid &pid, int16_t kp, int16_t ki, int16_t kd);
+void pid_set_gains(Pid &pid, int16_t kp, int16_t ki, int16_t kd);
+void pid_bumpless(Pid &pid, int16_t output);                        //next update continues from `output`
+void pid_feed_forward(Pid &pid, int16_t code);                      //output moves with `code`, jumps to it after a reset
+void pid_set_hold(Pid &pid, uint8_t samples);                       //updates held after a jump, PID_FF_HOLD by default
+int16_t pid_update(Pid &pid, int32_t setpoint, int32_t measured);   //returns the new DAC code
+
+#endif
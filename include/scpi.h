@@ -0,0 +1,89 @@
+#ifndef SCPI_H
+#define SCPI_H
+
+#include <Arduino.h>
+
+/////////////////////////////Remote control over the serial port//////////////////////////////////
+/*SCPI style commands, one per line (CR and/or LF), several per line separated by ';'. Keywords match in
+  their short (capital letters) or long form, any case. Values are in SCPI base units (A, W, ohm, V) and
+  may have decimals. Setting a value takes effect on the next regulation step, no digit entry needed.
+
+    *IDN?                     identification
+    *RST                      input off, back to the main menu, setpoints 0
+    MODE CR|CC|CP|CV|BATT|DYN|LIST|OFF  start a mode (OFF = main menu, DAC at 0). MODE? returns the mode
+                              BATT is the battery test: CURR is the discharge current, counters restart
+                              DYN is the dynamic load, switching between DYN:LEV1 and DYN:LEV2
+                              LIST runs the stored list from its first step
+    RESistance <ohm>          CR setpoint, 1 to 9999999 (rounded to whole ohms). RES? returns it
+    CURRent <A>               CC setpoint, 0 to 5. CURR? returns it
+    POWer <W>                 CP setpoint, 0 to 99.999. POW? returns it
+    VOLTage <V>               CV setpoint, 0 to 65: the load draws what holds the input there. VOLT? returns it
+    INPut ON|OFF|1|0          load on or paused (the red button). INP? returns 1 or 0. ON is refused while a
+                              protection trip is latched
+    BATTery:CUToff <V>        battery test cutoff voltage. BATT:CUT? returns it
+    BATTery:CAPacity?         battery test so far: Ah,Wh,seconds,ended (1 once the cutoff was reached)
+    DYNamic:LEVel1 <A>        dynamic load current for the first DUTY% of the period. DYN:LEV1? returns it
+    DYNamic:LEVel2 <A>        dynamic load current for the rest of the period. DYN:LEV2? returns it
+    DYNamic:FREQuency <Hz>    dynamic load switching frequency, 0.001 to 500. DYN:FREQ? returns it
+    DYNamic:DUTY <%>          share of the period at level 1, 1 to 99. DYN:DUTY? returns it
+    DYNamic:SLEW <A/ms>       ramp between the levels, 0 = step at once. DYN:SLEW? returns it
+    LIST:STEP <n>,<mode>,<value>,<s>[,<min V>,<max A>]
+                              store list step n (1 = first, count + 1 appends): CR|CC|CP, its setpoint in
+                              ohm/A/W, how long it lasts (0.01 s or more) and optional limits (0 = none)
+    LIST:STEP? <n>            step n in the same form
+    LIST:COUNt?               number of stored steps
+    LIST:CLEar                delete the list
+    LIST:STATus?              RUN|DONE|LIMIT|OFF,<step running or where it stopped>
+    CALibration:SWEep         measure the DAC to current table (feedforward.h), needs a supply on the input
+    CALibration:STATus?       RUN|DONE|FAIL|CAL|NOM,<points measured>: CAL/NOM = idle with a measured/nominal table
+    CALibration:TABle?        the table: mA at DAC codes 0, 256, 512 ... 3840, 4095
+    CALibration:CLEar         back to the nominal DAC gain
+    CALibration:CURRent <A>   what a meter in series reads while current flows (0.1A or more): the current
+                              calibration is scaled to match. CAL:CURR? returns the numerator (measure.h)
+    CALibration:VOLTage <V>   the same for the voltage (0.1V or more), against a meter on the input terminals,
+                              or on the device with remote sense, which has a calibration of its own
+    CALibration:CURRent:RANGe <A>   the same for the ADC range the current is in right now (acquisition.h), on
+                              top of CAL:CURR; ? returns <range>,<trim>. Not in range 0 (CAL:CURR covers it)
+    CALibration:VOLTage:RANGe <V>   the same for the voltage
+    PROTection:OCP <A>        over-current trip (protect.h), 0 = off. PROT:OCP? returns it
+    PROTection:OPP <W>        over-power trip, 0 = off. PROT:OPP? returns it
+    PROTection:UVP <V>        under-voltage trip while the load is on, 0 = off. PROT:UVP? returns it
+    PROTection:OVP <V>        over-voltage trip, 0 = off. PROT:OVP? returns it
+    PROTection:TRIPped?       latched trips: NONE or a list of OCP, OPP, UVP, OVP, OTP (heatsink), SNS (sense)
+    PROTection:CLEar          acknowledge the trip (the red button does the same), the input stays off
+    MEASure:CURRent?          measured current (A, to the uA)
+    MEASure:VOLTage?          measured voltage (V)
+    MEASure:POWer?            measured power (W)
+    MEASure:TEMPerature?      heatsink temperature (C), NAN without a working NTC (thermal.h)
+    MEASure:FAN?              fan PWM duty (%)
+    MEASure:DERating?         share of the setpoint the heatsink allows right now (%, 100 = no derating)
+    SENSe:REMote ON|OFF|1|0   voltage from the sense leads at the device, or local with them strapped to the
+                              load terminals (sense.h). SENS:REM? returns 1 or 0
+    SENSe:TERMinal?           voltage on the load terminals (V, ~54mV steps), what the sense leads are checked
+                              against; 0 on a board without the A7 divider (ACQ_TERMINAL_INPUT -1)
+    STATus?                   mode,input,V,A,W in one line
+    TELemetry ON|OFF          binary telemetry frames on or off (see telemetry.h). TEL? returns 1 or 0
+    PROFile:STATistics? <phase>  timing of a phase (profile.h): samples,min,mean,max in us. Phases are LOOP,
+                              ADC, CONTrol, DAC, LCD, BUTTons, REMote and BUS
+    PROFile:HISTogram? <phase>   the phase's histogram: counts below 8us, 8-15us, 16-31us ... 8ms and more
+    PROFile:RESet             start all the statistics again
+    SYSTem:LCD <address>      I2C address of the LCD backpack (decimal, 39 = 0x27), used from the next power up
+    SYSTem:DAC <address>      I2C address of the MCP4725 (decimal, 97 = 0x61), used from the next power up
+    SYSTem:ERRor?             oldest error, "0,No error" when none
+
+  Queries answer one line ending in LF. A reply is written to the UART as a whole line, so it never ends
+  up in the middle of a telemetry frame; while it waits for room the next line waits too (the parser reads
+  up to it, the RX buffer keeps the rest), so nothing here ever blocks the loop. Turn telemetry off when the reader can not separate the
+  frames (sync 0xA5 0x5A) from the text. Commands that save to the EEPROM (LIST:STEP, LIST:CLE, CAL:CLE) are
+  written in the background. One that finds no room in the queue (nvm.h) waits and runs again on the next
+  pass, and the commands after it wait behind it; the input is read on meanwhile, up to the next whole line.
+  Received bytes the RX buffer had no room for are reported as -363 by SYST:ERR?. Calibrations, addresses,
+  setpoints and limits are saved by themselves a moment after they last changed (config.h). The list can not
+  be changed while it runs. */
+
+#define SCPI_LINE_LEN   48          //longest command line, longer ones are rejected
+#define SCPI_REPLY_LEN  112         //longest reply line including the LF (CAL:TAB?), the rest is cut
+
+void scpi_poll();                   //call every pass of loop()
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SENSE_H
+#define SENSE_H
+
+#include <Arduino.h>
+
+/////////////////////////////Remote (4-wire) voltage sense//////////////////////////////////
+/*At a few amps the force leads drop a good part of a volt, so the voltage on the load terminals is not the
+  voltage of the device under test, and CR and CP regulate to the wrong point. The sense terminals take a
+  second pair of leads to the device itself, through the same 10K/100K divider each: S+ to AIN2, S- to AIN3.
+    local   (default) S+ and S- are strapped to the load terminals, the voltage is AIN2 on its own
+    remote  the voltage is AIN2-AIN3 differential, across the device. It has its own calibration (CAL:VOLT
+            calibrates the one in use), the ADC range trims are shared, they belong to the ADS1115
+  Only the mux setting of the voltage conversion changes (acq_set_remote), so the current is sampled as often
+  as before.
+
+  Open lead detector, with remote sense on: A7 reads the load terminals through a third 10K/100K divider on
+  the ATmega's own ADC (~54mV a count, acquisition.h). The device is never below the terminals (the leads only
+  drop) and never more than SENSE_LEAD_MAX_mV above, so a measured voltage outside that window, give or take
+  the A7 tolerance, means S+ is off (its divider pulls AIN2 to 0) or the leads are swapped. The A7 reading is
+  compared with the last unfiltered pair, taken within a conversion of it, so a load step does not look like
+  an open lead. After SENSE_OPEN_COUNT readings in a row the protection trips (PROTECT_SENSE, "SNS"): CP on a
+  voltage of 0 asks for the full current. An open S- is not seen: S- then reads the load's ground, which only
+  puts the negative lead's drop back into the reading. In local mode there are no sense leads to lose and
+  nothing is checked, so a unit built before the A7 divider runs as it did. A board without the divider sets
+  ACQ_TERMINAL_INPUT to -1 (acquisition.h): A7 is then never read. */
+
+#define SENSE_TERMINAL_uV   53711     //A7 uV per count: 5V / 1024 through the 10K/100K divider
+#define SENSE_TOLERANCE_mV  500       //plus 1/16 of the reading, for the 5V supply and the resistors
+#define SENSE_LEAD_MAX_mV   3000      //largest drop the two force leads may have together
+#define SENSE_OPEN_COUNT    3         //A7 readings in a row (~25ms) outside the window before the trip
+
+void sense_set_remote(bool remote);   //the voltage input (acquisition.h), the caller switches the calibration
+bool sense_remote();
+void sense_check(int16_t counts, long voltage_mV);   //new A7 counts against the voltage of the last pair
+long sense_terminal_mV();             //the load terminals as A7 read them last
+
+#endif
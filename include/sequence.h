@@ -0,0 +1,67 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <Arduino.h>
+
+/////////////////////////////List mode//////////////////////////////////
+/*A stored list of up to SEQ_MAX_STEPS steps, each one a mode (CR, CC or CP), its setpoint, how long it lasts
+  and two optional limits: the list stops with the load off if the voltage falls below min_mV or the current
+  goes above max_mA during the step (0 = no limit).
+
+  The step times are counted by the 1ms timer interrupt (tick.h), so the list does not drift however long
+  loop() takes, and the interrupt itself turns the DAC off at the end of the last step. Every step must last
+  at least SEQ_MIN_DWELL_MS: loop() reads the next step from the EEPROM while the current one runs.
+
+  EEPROM format at SEQ_EEPROM_ADDR, little endian:
+    0       SEQ_MAGIC
+    1       number of steps
+    2 + 12n step n: mode (5 = CR, 6 = CC, 7 = CP, the Menu_level numbers), setpoint (3 bytes, ohm/mA/mW),
+            dwell_ms (4 bytes), min_mV (2 bytes), max_mA (2 bytes)
+  Changes go through the background writer (nvm.h), so saving never stops the load. */
+
+#define SEQ_EEPROM_ADDR   0x200
+#define SEQ_MAGIC         0x5E
+#define SEQ_MAX_STEPS     16
+#define SEQ_STEP_BYTES    12
+#define SEQ_SAVE_BYTES    (SEQ_STEP_BYTES + 2)    //room seq_set() needs in the EEPROM queue, with the header
+#define SEQ_MIN_DWELL_MS  10
+
+#define SEQ_MODE_CR       5
+#define SEQ_MODE_CC       6
+#define SEQ_MODE_CP       7
+
+#define SEQ_STOPPED       0           //never started or stopped by the user
+#define SEQ_RUNNING       1
+#define SEQ_DONE          2           //last step finished
+#define SEQ_LIMIT         3           //a step limit was crossed
+
+struct SeqStep {
+  uint8_t mode;
+  long setpoint;              //ohm, mA or mW
+  uint32_t dwell_ms;
+  uint16_t min_mV;            //0 = no limit
+  uint16_t max_mA;            //0 = no limit
+};
+
+//Stored list
+uint8_t seq_count();
+bool seq_get(uint8_t index, SeqStep &step);           //false if there is no such step
+bool seq_valid(const SeqStep &step);
+//Replace step `index` or append it (index == seq_count()). False if the step is not valid, the list is full
+//or running, or the EEPROM queue has no room (try again once nvm_free() >= SEQ_SAVE_BYTES).
+bool seq_set(uint8_t index, const SeqStep &step);
+bool seq_truncate(uint8_t count);                     //keep the first `count` steps
+
+//Running it
+bool seq_start();                   //from the first step, false if the list is empty
+void seq_stop();
+void seq_hold(bool hold);           //pause: the step time stands still
+void seq_poll();                    //call every pass of loop(), follows the timer to the next step
+uint8_t seq_status();
+uint8_t seq_index();                //step running (or where the list ended)
+const SeqStep &seq_step();          //the step running
+uint32_t seq_remaining_ms();        //time left in the step
+bool seq_check(long mV, long mA);   //limits of the running step, stops the list and returns false if crossed
+void seq_output(uint16_t code);     //DAC write that can not undo the timer's load off at the end of the list
+
+#endif
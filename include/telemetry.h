@@ -0,0 +1,42 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "acquisition.h"
+
+/////////////////////////////Binary telemetry stream//////////////////////////////////
+/*One frame per current/voltage pair (every regulation step), sent through the UART ring buffer so it costs
+  the loop a few microseconds and never waits. If the link can not keep up a whole frame is dropped and the
+  next frame's sequence number shows the gap.
+
+  Frame, 18 bytes, multi byte fields little endian:
+    0   0xA5 0x5A       sync
+    2   seq             uint8, +1 per frame produced (dropped ones included)
+    3   stamp_us        uint32, micros() when the pair was completed
+    7   current_raw     int16, ADS1115 counts AIN0-AIN1, in the range of byte 15
+    9   voltage_raw     int16, ADS1115 counts AIN2 (AIN2-AIN3 with remote sense), in the range of byte 15
+    11  dac             uint16, code last written to the MCP4725
+    13  mode            uint8, Menu_level (5 = CR, 6 = CC, 7 = CP, 17 = CV, 9 = battery test, 11 = dynamic, 14 = list,
+                        15 = DAC sweep)
+    14  flags           uint8, TLM_FLAG_xxx
+    15  ranges          uint8, ADC range of the current (bits 0-3) and the voltage (bits 4-7), 0 = +/-6.144V
+                        ... 5 = +/-0.256V (acquisition.h): counts * FSR / 32768 is the voltage at the ADC pins
+    16  crc             uint16, CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of bytes 2..15 */
+
+#define TELEMETRY_BAUD      500000
+
+#define TLM_FLAG_PAUSE      0x01    //regulation paused, DAC at 0
+#define TLM_FLAG_OVERRANGE  0x02    //current reading near full scale, treated as 0
+#define TLM_FLAG_DROPPED    0x04    //at least one frame was dropped since the last one sent
+#define TLM_FLAG_CUTOFF     0x08    //battery test ended at the cutoff voltage
+#define TLM_FLAG_TRIP       0x10    //a protection trip is latched (protect.h), DAC at 0
+
+#define TLM_FRAME_LEN       18
+
+void telemetry_begin();
+void telemetry_send(const AcqSample &sample, uint16_t dac, uint8_t mode, uint8_t flags);
+uint16_t telemetry_dropped();       //frames dropped since boot
+void telemetry_enable(bool on);     //on after telemetry_begin()
+bool telemetry_enabled();
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <Arduino.h>
+
+/////////////////////////////Heatsink temperature, fan and derating//////////////////////////////////
+/*A 10k NTC (B 3950) on the heatsink, from A6 to GND with a 10k pullup to 5V. The acquisition engine reads it
+  with the ATmega's ADC after every ACQ_TEMP_PAIRS current/voltage pairs (acquisition.h), so the ADS1115 is
+  left to the regulation. The counts go through a table (one point every 10C from 0 to 150C, straight lines in
+  between) to tenths of a degree; around the derating range one count is about half a degree.
+
+  On every new temperature:
+    fan       PI loop holding the heatsink at THERM_FAN_C, PWM on THERM_FAN_PIN (analogWrite, so Timer0 at
+              ~1kHz and millis() keeps working; the 1ms tick has Timer1 and tone() Timer2). Below
+              THERM_FAN_MIN_DUTY a fan stalls, so the output is either 0 or at least that.
+    derating  above THERM_DERATE_C the target current of every mode is scaled down, in a straight line to
+              0 at THERM_MAX_C. The heatsink then settles where the power it can shed meets the derated
+              load, instead of the test being stopped.
+    trip      at THERM_MAX_C the protection trips (PROTECT_OTP in protect.h), latched like the others.
+
+  A reading outside the table (NTC open or shorted) runs the fan flat out and neither derates nor trips, so
+  a loose wire does not stop a test; therm_valid() tells. */
+
+#define THERM_FAN_PIN       6         //D6, Timer0 OC0A
+#define THERM_FAN_C         450       //tenths of a degree C
+#define THERM_DERATE_C      800
+#define THERM_MAX_C         1000
+#define THERM_FAN_MIN_DUTY  64        //of 255
+#define THERM_FAN_KP        40        //duty per tenth of a degree above THERM_FAN_C, Q4
+#define THERM_FAN_KI        8         //integral gain per sample, Q8
+
+void therm_begin();
+void therm_sample(int16_t raw);       //new A6 result: fan, derating and the trip
+bool therm_valid();                   //the last reading was inside the table
+int16_t therm_temperature();          //tenths of a degree C
+uint8_t therm_fan();                  //PWM duty, 0-255
+uint16_t therm_derate();              //scale of the target currents, Q8 (256 = none)
+long therm_limit(long mA);            //mA scaled by the derating
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include <Arduino.h>
+
+/////////////////////////////1ms hardware tick//////////////////////////////////
+/*Timer1 in CTC mode interrupts every millisecond and calls one handler, for the modes that need output
+  edges at exact times (dynamic load, sequences) instead of whenever loop() comes round. Only one mode runs at
+  a time so there is one handler. It runs in interrupt context: keep it short, no waiting, no Serial, no LCD. */
+
+#define TICK_US   1000
+
+typedef void (*TickHandler)();
+
+void tick_start(TickHandler handler);   //replaces any previous handler
+void tick_stop();
+
+//Hardware layer, implemented by Timer1 on AVR and by the simulator on the host.
+void tick_hw_start(uint16_t period_us);
+void tick_hw_stop();
+void tick_interrupt();                  //called by the timer interrupt
+
+#endif
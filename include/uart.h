@@ -0,0 +1,31 @@
+#ifndef UART_H
+#define UART_H
+
+#include <Arduino.h>
+
+/////////////////////////////Interrupt driven UART//////////////////////////////////
+/*Replaces Serial for the telemetry stream and the remote commands. uart_write() copies into a ring buffer and
+  returns; the USART data register empty interrupt feeds the bytes to the hardware one at a time. Nothing here
+  waits: a write that does not fit is refused whole (so a frame or a reply line is never cut in half) and the
+  caller decides what to do with it. Received bytes are put in a second ring buffer by the RX interrupt and
+  read with uart_read(); if the loop falls behind by more than UART_RX_SIZE bytes the newest ones are lost,
+  and uart_rx_overflow() says so once.
+
+  Serial must not be used together with this, HardwareSerial owns the same interrupts. */
+
+#define UART_TX_SIZE  128           //power of two
+#define UART_RX_SIZE  64            //power of two
+
+void uart_begin(uint32_t baud);     //8N1, 500000 and 1000000 are exact at 16MHz
+bool uart_write(const uint8_t *data, uint8_t len);    //all or nothing, never waits
+uint8_t uart_tx_free();
+int uart_read();                    //next received byte, -1 if none
+bool uart_rx_overflow();            //received bytes were lost since the last call
+
+//Hardware layer, implemented by the USART interrupt on AVR and by the simulator on the host.
+void uart_hw_begin(uint32_t baud);
+void uart_hw_kick();                //bytes are waiting, make sure the TX interrupt runs
+bool uart_tx_pop(uint8_t &value);   //for the TX interrupt: next byte, false when the buffer is empty
+void uart_rx_push(uint8_t value);   //for the RX interrupt
+
+#endif
@@ -0,0 +1,120 @@
+# RAM/flash use per module, printed after every firmware link (extra_scripts in platformio.ini).
+#
+# The linker writes a map file, and every input section that made it into the image (after --gc-sections)
+# is added to the object it came from. The figures are therefore what each module really costs:
+#   flash = .text + .progmem + .rodata + .data (initial values are stored in flash)
+#   RAM   = .data + .bss + COMMON              (static RAM only, the stack comes out of what is left)
+# src/*.cpp are listed one by one, the Arduino core, libraries and libc/libgcc as one line each.
+#
+# custom_stack_reserve (bytes, platformio.ini) is the RAM that must stay free for the stack and the
+# interrupts. The report warns when the static RAM leaves less than that.
+
+import os
+import re
+import sys
+
+FLASH_SECTIONS = (".text", ".progmem", ".rodata", ".data", ".init", ".fini", ".vectors", ".trampolines",
+                  ".ctors", ".dtors", ".jumptables", ".lowtext")
+RAM_SECTIONS = (".data", ".bss", ".noinit", "COMMON")
+
+SECTION = re.compile(r"^ (\S+)\s*$")                                  # name alone, numbers on the next line
+ENTRY = re.compile(r"^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+
+
+def starts(name, prefixes):
+    return any(name == p or name.startswith(p + ".") or name.startswith(p + "_") for p in prefixes)
+
+
+def module(path):
+    path = path.strip().replace("\\", "/")
+    if "/src/" in path and path.endswith(".o"):
+        return os.path.basename(path)[:-2]                          # main.cpp.o -> main.cpp
+    if "FrameworkArduino" in path:
+        return "Arduino core"
+    m = re.search(r"/lib[^/]*/([^/]+)/", path)
+    if m and ".pio" in path:
+        return "lib " + m.group(1)
+    if "libgcc" in path or "libc" in path or "libm" in path or "crt" in path:
+        return "libc/libgcc"
+    return os.path.basename(path.split("(")[0])
+
+
+def parse_map(text):
+    sizes = {}
+    in_map = False
+    pending = None
+    for line in text.splitlines():
+        if line.startswith("Linker script and memory map"):
+            in_map = True
+            continue
+        if not in_map:
+            continue
+        if line.startswith("/DISCARD/"):
+            break
+        m = SECTION.match(line)
+        if m and not line.startswith("  "):
+            pending = m.group(1)
+            continue
+        m = ENTRY.match(line)
+        if not m:
+            pending = None
+            continue
+        name = m.group(1) or pending
+        pending = None
+        size = int(m.group(3), 16)
+        if not name or name == "*fill*" or size == 0 or not m.group(4).strip().endswith((".o", ")")):
+            continue
+        flash = size if starts(name, FLASH_SECTIONS) else 0
+        ram = size if starts(name, RAM_SECTIONS) else 0
+        if not flash and not ram:
+            continue
+        entry = sizes.setdefault(module(m.group(4)), [0, 0])
+        entry[0] += flash
+        entry[1] += ram
+    return sizes
+
+
+def print_report(sizes, flash_max, ram_max, reserve):
+    flash_total = sum(s[0] for s in sizes.values())
+    ram_total = sum(s[1] for s in sizes.values())
+    print("")
+    print("Module                      Flash      RAM")
+    for name, (flash, ram) in sorted(sizes.items(), key=lambda kv: (-kv[1][1], -kv[1][0])):
+        print("%-24s %8d %8d" % (name, flash, ram))
+    print("%-24s %8d %8d" % ("total", flash_total, ram_total))
+    if flash_max and ram_max:
+        print("%-24s %7.1f%% %7.1f%%  of %d / %d bytes" % ("used", 100.0 * flash_total / flash_max,
+              100.0 * ram_total / ram_max, flash_max, ram_max))
+        free = ram_max - ram_total
+        print("RAM left for the stack: %d bytes (reserve %d)" % (free, reserve))
+        if free < reserve:
+            print("WARNING: static RAM leaves less than custom_stack_reserve for the stack")
+    print("")
+
+
+def report(source, target, env):
+    map_path = env.subst("$BUILD_DIR/${PROGNAME}.map")
+    if not os.path.isfile(map_path):
+        print("size_report: no map file at " + map_path)
+        return
+    with open(map_path) as f:
+        sizes = parse_map(f.read())
+    board = env.BoardConfig()
+    reserve = int(env.GetProjectOption("custom_stack_reserve", "0"))
+    print_report(sizes, int(board.get("upload.maximum_size", 0)), int(board.get("upload.maximum_ram_size", 0)),
+                 reserve)
+
+
+try:
+    Import("env")
+except NameError:
+    env = None
+
+if env is not None:
+    env.Append(LINKFLAGS=["-Wl,-Map,${BUILD_DIR}/${PROGNAME}.map"])
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)
+elif __name__ == "__main__" and len(sys.argv) > 1:
+    # python scripts/size_report.py firmware.map [flash_max ram_max reserve]
+    with open(sys.argv[1]) as f:
+        args = [int(a) for a in sys.argv[2:5]] + [0, 0, 0]
+        print_report(parse_map(f.read()), args[0], args[1], args[2])
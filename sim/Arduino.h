@@ -0,0 +1,91 @@
+#ifndef ARDUINO_H_SIM
+#define ARDUINO_H_SIM
+
+//Minimal Arduino core for the host simulation (see sim.h). Only what the firmware uses is provided.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <cmath>
+#include <cstdlib>
+
+using std::abs;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+#define FALLING 2
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void analogWrite(uint8_t pin, int value);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+//AVR registers touched by the firmware. PINB is driven by sim_encoder_step(). Interrupts only run inside
+//sim_advance(), so saving SREG and cli() need no real effect.
+extern volatile uint8_t PCICR, PCMSK0, DDRB, PINB, SREG;
+#define PCIE0  0
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define B00000010 2
+#define B00000100 4
+#define B11111001 249
+
+#define ISR(vector) void vector(void)
+inline void cli() {}
+inline void sei() {}
+
+//Flash and RAM are one address space on the host, so the PROGMEM readers are plain loads
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+
+//F("text") keeps the text in flash on the AVR, Print reads it from there
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+//No String: the firmware allocates nothing at run time (fixed buffers and PROGMEM text only)
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  size_t write(const char *str);
+  size_t print(const char *str);
+  size_t print(const __FlashStringHelper *str);
+  size_t print(char c);
+  size_t print(unsigned char value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+};
+
+#endif
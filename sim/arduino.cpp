@@ -0,0 +1,57 @@
+#include <Arduino.h>
+#include <stdio.h>
+#include "sim.h"
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t pin) { return sim_pin(pin) ? HIGH : LOW; }
+void analogWrite(uint8_t pin, int value) { sim_analog_write(pin, value); }
+unsigned long millis() { return (unsigned long)(sim_time_us() / 1000); }
+unsigned long micros() { return (unsigned long)sim_time_us(); }
+void delay(unsigned long ms) { sim_advance((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { sim_advance(us); }
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode) { sim_attach_interrupt(interrupt, handler, mode); }
+void tone(uint8_t, unsigned int, unsigned long) {}
+void noTone(uint8_t) {}
+
+
+size_t Print::write(const char *str)
+{
+  size_t n = 0;
+  while(*str) n += write((uint8_t)*str++);
+  return n;
+}
+
+size_t Print::print(const char *str) { return write(str); }
+size_t Print::print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+
+size_t Print::print(long value, int base)
+{
+  char buf[40];
+  if(base == HEX) snprintf(buf, sizeof(buf), "%lX", value);
+  else snprintf(buf, sizeof(buf), "%ld", value);
+  return write(buf);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  char buf[40];
+  if(base == HEX) snprintf(buf, sizeof(buf), "%lX", value);
+  else snprintf(buf, sizeof(buf), "%lu", value);
+  return write(buf);
+}
+
+size_t Print::print(unsigned char value, int base) { return print((unsigned long)value, base); }
+size_t Print::print(int value, int base) { return print((long)value, base); }
+size_t Print::print(unsigned int value, int base) { return print((unsigned long)value, base); }
+
+size_t Print::print(double value, int digits)
+{
+  char buf[48];
+  if(isnan(value)) return write("nan");
+  if(isinf(value)) return write("inf");
+  if(value > 4294967040.0 || value < -4294967040.0) return write("ovf");   //same limits as the AVR core
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+  return write(buf);
+}
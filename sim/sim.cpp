@@ -0,0 +1,644 @@
+#include "sim.h"
+#include <Arduino.h>
+#include "i2c_bus.h"
+#include "uart.h"
+#include "tick.h"
+#include "nvm.h"
+#include "acquisition.h"
+#include <math.h>
+#include <string.h>
+
+void loop();
+void PCINT0_vect(void);               //encoder interrupt defined by the firmware
+
+static SimConfig config;
+static SimStats stats;
+
+static uint64_t now_us = 0;           //simulated time
+static uint64_t plant_us = 0;         //time the plant state below belongs to
+static double i_lag = 0;              //lagged load current demand (A)
+static uint16_t dac_code = 0;
+static double heatsink_c = 25;        //heatsink temperature (C)
+static uint8_t fan_duty = 0;
+static uint32_t noise_state = 1;
+
+//I2C: the transaction being clocked out, when it started and ends, and the clock the firmware asked for
+static I2cTransaction *bus_txn = 0;
+static uint64_t bus_start_us = 0;
+static uint64_t bus_done_us = 0;
+static uint32_t bus_hz = 100000;
+
+//ADS1115 at 0x48: one single shot conversion can be in flight
+static bool adc_pending = false;
+static bool adc_ready = false;        //ALERT/RDY asserted
+static uint64_t adc_done_us = 0;
+static uint8_t adc_pointer = 0;
+static uint16_t adc_config = 0x8583;  //power on default
+static int16_t adc_result = 0;
+
+//ATmega ADC: one conversion at a time, the input is sampled when the result is read
+static uint8_t aux_input = 0;
+static uint64_t aux_done_us = 0;
+
+//UART: TX runs while the interrupt has bytes to give, what it sends is kept for sim_uart_take()
+static uint32_t uart_baud = 0;
+static bool uart_active = false;
+static uint64_t uart_done_us = 0;
+static uint8_t uart_out[65536];
+static uint16_t uart_out_head = 0, uart_out_tail = 0;
+static bool uart_rx_active = false;   //bytes from sim_uart_send() arrive one byte time apart
+static uint64_t uart_rx_done_us = 0;
+static uint8_t uart_in[4096];
+static uint16_t uart_in_head = 0, uart_in_tail = 0;
+
+//Timer1 tick: interrupts every tick_period_us while running
+static bool tick_active = false;
+static uint32_t tick_period_us = 0;
+static uint64_t tick_next_us = 0;
+
+//EEPROM: keeps its contents across sim_reset() like the real one across power cycles
+#define SIM_EEPROM_WRITE_US  3400
+static uint8_t eeprom[1024];
+static bool eeprom_init = false;
+static uint64_t eeprom_busy_until = 0;
+
+//PCF8574 at 0x27 driving the HD44780 in 4 bit mode
+static uint8_t pcf_out = 0;
+static bool hd_4bit = false;
+static uint64_t hd_busy_until = 0;    //the HD44780 is executing the last command until then
+static bool hd_high_nibble = true;
+static uint8_t hd_nibble = 0;
+
+//HD44780 DDRAM: two rows of 40 characters, the first 16 are visible
+static char lcd_ram[2][40];
+static uint8_t lcd_row = 0, lcd_col = 0;
+static bool lcd_cgram = false;
+static char lcd_visible[2][17];
+
+static bool pin_level[32];
+static void (*int_handler[2])(void);  //attachInterrupt() handlers of INT0 (D2) and INT1 (D3)
+static bool in_event = false;
+volatile uint8_t PCICR, PCMSK0, DDRB, PINB, SREG;
+
+
+SimConfig sim_default_config()
+{
+  SimConfig c;
+  c.source_v = 12.0;
+  c.source_r = 0.1;
+  c.lead_r = 0;
+  c.sense = SIM_SENSE_LOCAL;
+  c.shunt_r = 1.0;
+  c.divider = 10.0 / 110.0;
+  c.dac_vref = 5.0;
+  c.gm = 1.0;
+  c.vth = 0.0;
+  c.tau_us = 500;
+  c.adc_noise = 2;
+  c.ambient_c = 25;
+  c.heatsink_j_per_c = 40;
+  c.heatsink_c_per_w = 2.0;
+  c.fan_c_per_w = 0.6;
+  c.fan_pin = 6;
+  c.i2c_hz = 400000;
+  c.loop_us = 150;
+  c.rdy_pin = 2;
+  c.seed = 1;
+  return c;
+}
+
+void sim_reset(const SimConfig &c)
+{
+  config = c;
+  memset(&stats, 0, sizeof(stats));
+  now_us = plant_us = 0;
+  i_lag = 0;
+  dac_code = 0;
+  heatsink_c = c.ambient_c;
+  fan_duty = 0;
+  noise_state = c.seed ? c.seed : 1;
+  bus_txn = 0;
+  bus_hz = 100000;
+  uart_baud = 0;
+  uart_active = false;
+  uart_out_head = uart_out_tail = 0;
+  uart_rx_active = false;
+  uart_in_head = uart_in_tail = 0;
+  tick_active = false;
+  if(!eeprom_init){
+    sim_eeprom_erase();
+  }
+  eeprom_busy_until = 0;
+  adc_pending = adc_ready = false;
+  adc_pointer = 0;
+  adc_config = 0x8583;
+  adc_result = 0;
+  aux_input = 0;
+  aux_done_us = 0;
+  pcf_out = 0;
+  hd_4bit = false;
+  hd_busy_until = 0;
+  hd_high_nibble = true;
+  int_handler[0] = int_handler[1] = 0;
+  in_event = false;
+  memset(lcd_ram, ' ', sizeof(lcd_ram));
+  lcd_row = lcd_col = 0;
+  lcd_cgram = false;
+  for(int i = 0; i < 32; i++) pin_level[i] = true;
+  PINB = 0x06;                        //encoder CLK and DT idle high
+}
+
+SimConfig &sim_config() { return config; }
+const SimStats &sim_stats() { return stats; }
+uint64_t sim_time_us() { return now_us; }
+uint16_t sim_dac_code() { return dac_code; }
+double sim_heatsink() { return heatsink_c; }
+uint8_t sim_fan() { return fan_duty; }
+
+
+/////////////////////////////Plant//////////////////////////////////
+
+static double current_limit()
+{
+  if(config.source_v <= 0) return 0;
+  return config.source_v / (config.source_r + 2 * config.lead_r + config.shunt_r);
+}
+
+double sim_current()
+{
+  double limit = current_limit();
+  return i_lag < limit ? i_lag : limit;
+}
+
+double sim_device_voltage()
+{
+  return config.source_v - sim_current() * config.source_r;
+}
+
+double sim_voltage()
+{
+  return sim_device_voltage() - 2 * sim_current() * config.lead_r;
+}
+
+//S+ (positive) or S- against the load's ground, the negative load terminal
+static double sense_volts(bool positive)
+{
+  double lead = sim_current() * config.lead_r;
+  if(config.sense == SIM_SENSE_LOCAL) return positive ? sim_voltage() : 0;
+  if(!positive) return -lead;
+  return config.sense == SIM_SENSE_OPEN ? 0 : sim_voltage() + lead;
+}
+
+static void plant_to(uint64_t t)
+{
+  if(t <= plant_us) return;
+  double vdac = dac_code * config.dac_vref / 4096.0;
+  double demand = config.gm * (vdac - config.vth);
+  if(demand < 0) demand = 0;
+  double dt = (double)(t - plant_us);
+  double k = config.tau_us > 0 ? 1.0 - exp(-dt / config.tau_us) : 1.0;
+  i_lag += (demand - i_lag) * k;
+
+  double i = sim_current();
+  double watts = i * (sim_voltage() - i * config.shunt_r);
+  double r_th = config.heatsink_c_per_w - (config.heatsink_c_per_w - config.fan_c_per_w) * fan_duty / 255.0;
+  double tau_us = r_th * config.heatsink_j_per_c * 1e6;
+  double settle = config.ambient_c + watts * r_th;
+  heatsink_c += (settle - heatsink_c) * (tau_us > 0 ? 1.0 - exp(-dt / tau_us) : 1.0);
+  plant_us = t;
+}
+
+//NTC (10k at 25C, B 3950) from A6 to GND, 10k from 5V to A6
+static double ntc_volts()
+{
+  double r = 10000.0 * exp(3950.0 * (1.0 / (heatsink_c + 273.15) - 1.0 / 298.15));
+  return 5.0 * r / (r + 10000.0);
+}
+
+static double noise()
+{
+  noise_state = noise_state * 1664525u + 1013904223u;
+  return ((noise_state >> 8) / 16777216.0 * 2.0 - 1.0) * config.adc_noise;
+}
+
+static int16_t adc_convert()
+{
+  static const double full_scale[6] = {6.144, 4.096, 2.048, 1.024, 0.512, 0.256};
+  double volts = 0;
+  switch(adc_config & 0x7000){
+    case 0x0000: volts = sim_current() * config.shunt_r; break;        //AIN0-AIN1
+    case 0x3000: volts = (sense_volts(true) - sense_volts(false)) * config.divider; break;   //AIN2-AIN3
+    case 0x6000: volts = sense_volts(true) * config.divider; break;    //AIN2
+    case 0x7000: volts = sense_volts(false) * config.divider; break;   //AIN3
+    default: break;
+  }
+  double counts = volts / (full_scale[((adc_config >> 9) & 7) % 6] / 32768.0) + noise();
+  if(counts > 32767) counts = 32767;
+  if(counts < -32768) counts = -32768;
+  return (int16_t)lround(counts);
+}
+
+static void adc_done()
+{
+  plant_to(adc_done_us);
+  adc_result = adc_convert();
+  adc_pending = false;
+  adc_config |= 0x8000;               //OS reads back 1: idle
+  stats.adc_conversions++;
+  bool falling = !adc_ready;
+  adc_ready = true;
+  int irq = config.rdy_pin - 2;       //D2 is INT0, D3 is INT1
+  if(falling && (irq == 0 || irq == 1) && int_handler[irq]){
+    int_handler[irq]();
+  }
+}
+
+static void bus_done();
+static void uart_done();
+static void uart_rx_done();
+
+//Events are handled in time order. Handlers may start new transactions or conversions, which then get
+//picked up by the same loop, but must not wait themselves (they run as interrupts).
+void sim_advance(uint64_t us)
+{
+  uint64_t target = now_us + us;
+  if(in_event){                       //a handler waiting would hang the real thing too
+    now_us = target;
+    return;
+  }
+  in_event = true;
+  for(;;){
+    uint64_t next = target + 1;
+    int event = 0;
+    if(bus_txn && bus_done_us < next){ next = bus_done_us; event = 1; }
+    if(adc_pending && adc_done_us < next){ next = adc_done_us; event = 2; }
+    if(uart_active && uart_done_us < next){ next = uart_done_us; event = 3; }
+    if(uart_rx_active && uart_rx_done_us < next){ next = uart_rx_done_us; event = 4; }
+    if(tick_active && tick_next_us < next){ next = tick_next_us; event = 5; }
+    if(!event) break;
+    now_us = next;
+    if(event == 1) bus_done();
+    else if(event == 2) adc_done();
+    else if(event == 3) uart_done();
+    else if(event == 4) uart_rx_done();
+    else{
+      tick_next_us += tick_period_us;
+      tick_interrupt();
+    }
+  }
+  in_event = false;
+  plant_to(target);
+  now_us = target;
+}
+
+void sim_run_loop()
+{
+  loop();
+  stats.loops++;
+  sim_advance(config.loop_us);
+}
+
+
+/////////////////////////////Devices//////////////////////////////////
+
+static void lcd_byte(uint8_t value, bool data, uint64_t at_us)
+{
+  stats.lcd_bytes++;
+  hd_busy_until = at_us + ((!data && (value == 0x01 || value == 0x02 || value == 0x03)) ? 1520 : 37);
+  if(data){
+    if(!lcd_cgram){
+      lcd_ram[lcd_row][lcd_col] = value;
+      lcd_col = (lcd_col + 1) % 40;
+    }
+    return;
+  }
+  if(value & 0x80){                   //set DDRAM address
+    lcd_row = (value & 0x40) ? 1 : 0;
+    lcd_col = (value & 0x3F) % 40;
+    lcd_cgram = false;
+  }
+  else if(value & 0x40){              //set CGRAM address, the following data defines a custom char
+    lcd_cgram = true;
+  }
+  else if(value == 0x01){             //clear display
+    memset(lcd_ram, ' ', sizeof(lcd_ram));
+    lcd_row = lcd_col = 0;
+    lcd_cgram = false;
+  }
+  else if(value == 0x02 || value == 0x03){ //return home
+    lcd_row = lcd_col = 0;
+    lcd_cgram = false;
+  }
+}
+
+//PCF8574 output byte: D7-D4 data nibble, EN = 0x04, RS = 0x01. The HD44780 latches on the falling edge of EN.
+//It powers up in 8 bit mode, where every nibble is a whole command; function set 0x2 switches to nibble pairs.
+//A latch while the last command is still executing is counted in lcd_timing_errors.
+static void pcf_write(uint8_t value, uint64_t at_us)
+{
+  bool latch = (pcf_out & 0x04) && !(value & 0x04);
+  pcf_out = value;
+  if(!latch) return;
+  if(at_us < hd_busy_until) stats.lcd_timing_errors++;
+  uint8_t nibble = value >> 4;
+  if(!hd_4bit){
+    hd_busy_until = at_us + 100;      //the first 0x3 takes 4.1ms, but init() waits 4.5ms after each one
+    if(nibble == 0x02){
+      hd_4bit = true;
+      hd_high_nibble = true;
+    }
+    return;
+  }
+  if(hd_high_nibble){
+    hd_nibble = nibble;
+    hd_high_nibble = false;
+    return;
+  }
+  hd_high_nibble = true;
+  lcd_byte((hd_nibble << 4) | nibble, value & 0x01, at_us);
+}
+
+static void dac_write(uint16_t code)
+{
+  plant_to(now_us);
+  dac_code = code & 0x0FFF;
+  stats.dac_writes++;
+}
+
+//MCP4725 at 0x60-0x67: fast write (2 bytes, C2 C1 = 00) or write DAC / DAC + EEPROM (3 bytes)
+static bool mcp4725_transaction(const I2cTransaction &t)
+{
+  if(t.tx_len == 2 && (t.tx[0] & 0xC0) == 0x00){
+    dac_write(((uint16_t)(t.tx[0] & 0x0F) << 8) | t.tx[1]);
+    return true;
+  }
+  if(t.tx_len == 3 && (t.tx[0] & 0xC0) == 0x40){
+    dac_write(((uint16_t)t.tx[1] << 4) | (t.tx[2] >> 4));
+    return true;
+  }
+  return t.tx_len == 0;
+}
+
+static bool ads1115_transaction(const I2cTransaction &t)
+{
+  static const uint16_t sps[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+  if(t.tx_len >= 1){
+    adc_pointer = t.tx[0] & 0x03;
+  }
+  if(t.tx_len >= 3 && adc_pointer == 0x01){
+    adc_config = ((uint16_t)t.tx[1] << 8) | t.tx[2];
+    if(adc_config & 0x8000){          //OS: a conversion starts at the stop condition
+      adc_config &= ~0x8000;
+      adc_pending = true;
+      adc_ready = false;
+      adc_done_us = now_us + 1000000UL / sps[(adc_config >> 5) & 0x07];
+    }
+  }
+  if(t.rx_len){
+    uint16_t value = 0;
+    if(adc_pointer == 0x00) value = (uint16_t)adc_result;
+    else if(adc_pointer == 0x01) value = adc_config;
+    t.rx[0] = value >> 8;
+    if(t.rx_len > 1) t.rx[1] = value & 0xFF;
+  }
+  return true;
+}
+
+static bool device_transaction(const I2cTransaction &t)
+{
+  if(t.address == 0x48) return ads1115_transaction(t);
+  if((t.address & 0xF8) == 0x60) return mcp4725_transaction(t);
+  if(t.address == 0x27){
+    for(uint8_t i = 0; i < t.tx_len; i++){    //each byte reaches the pins at its ack: start + address + i + 1 bytes
+      pcf_write(t.tx[i], bus_start_us + (uint64_t)(1 + (i + 2) * 9) * 1000000ULL / bus_hz);
+    }
+    return true;
+  }
+  return false;                       //nobody answers: address NACK
+}
+
+static void bus_done()
+{
+  I2cTransaction *t = bus_txn;
+  bus_txn = 0;
+  plant_to(now_us);
+  bool ok = device_transaction(*t);
+  i2c_hw_finished(ok);                //as the TWI interrupt would, may start the next transaction
+}
+
+
+/////////////////////////////UART hardware layer//////////////////////////////////
+
+static uint64_t uart_byte_us()
+{
+  return uart_baud ? 10000000ULL / uart_baud : 0;    //start + 8 data + stop, rounded down to whole us
+}
+
+//Like the data register empty interrupt: take the next byte, it is on the wire for one byte time
+static void uart_done()
+{
+  uint8_t value;
+  if(!uart_tx_pop(value)){
+    uart_active = false;
+    return;
+  }
+  uart_out[uart_out_head++] = value;
+  if(uart_out_head == uart_out_tail) uart_out_tail++;   //full: the oldest byte goes
+  stats.uart_bytes++;
+  uart_done_us = now_us + (uart_byte_us() ? uart_byte_us() : 1);
+}
+
+void uart_hw_begin(uint32_t baud)
+{
+  uart_baud = baud;
+  uart_active = false;
+}
+
+void uart_hw_kick()
+{
+  if(!uart_active && uart_baud){
+    uart_active = true;
+    uart_done_us = now_us;
+  }
+}
+
+//Like the RX interrupt: one byte has been received
+static void uart_rx_done()
+{
+  if(uart_in_tail == uart_in_head){
+    uart_rx_active = false;
+    return;
+  }
+  uart_rx_push(uart_in[uart_in_tail]);
+  uart_in_tail = (uart_in_tail + 1) % sizeof(uart_in);
+  uart_rx_done_us = now_us + (uart_byte_us() ? uart_byte_us() : 1);
+}
+
+void sim_uart_send(const char *text)
+{
+  while(*text){
+    uint16_t next = (uart_in_head + 1) % sizeof(uart_in);
+    if(next == uart_in_tail) break;
+    uart_in[uart_in_head] = *text++;
+    uart_in_head = next;
+  }
+  if(!uart_rx_active){
+    uart_rx_active = true;
+    uart_rx_done_us = now_us + (uart_byte_us() ? uart_byte_us() : 1);
+  }
+}
+
+size_t sim_uart_take(uint8_t *buf, size_t len)
+{
+  size_t n = 0;
+  while(n < len && uart_out_tail != uart_out_head){
+    buf[n++] = uart_out[uart_out_tail++];
+  }
+  return n;
+}
+
+
+/////////////////////////////Timer hardware layer//////////////////////////////////
+
+void tick_hw_start(uint16_t period_us)
+{
+  tick_period_us = period_us ? period_us : 1;
+  tick_next_us = now_us + tick_period_us;
+  tick_active = true;
+}
+
+void tick_hw_stop()
+{
+  tick_active = false;
+}
+
+
+/////////////////////////////EEPROM hardware layer//////////////////////////////////
+
+void sim_eeprom_erase()
+{
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  eeprom_init = true;
+}
+
+bool nvm_hw_ready()
+{
+  return now_us >= eeprom_busy_until;
+}
+
+uint8_t nvm_hw_read(uint16_t address)
+{
+  return eeprom[address % sizeof(eeprom)];
+}
+
+void nvm_hw_write(uint16_t address, uint8_t value)
+{
+  eeprom[address % sizeof(eeprom)] = value;
+  eeprom_busy_until = now_us + SIM_EEPROM_WRITE_US;
+  stats.eeprom_writes++;
+}
+
+
+/////////////////////////////ATmega ADC hardware layer//////////////////////////////////
+
+void acq_hw_aux_start(uint8_t input)
+{
+  aux_input = input;
+  aux_done_us = now_us + 104;         //13 ADC clocks at 125kHz
+}
+
+bool acq_hw_aux_busy()
+{
+  return now_us < aux_done_us;
+}
+
+uint16_t acq_hw_aux_result()
+{
+  plant_to(now_us);
+  double volts = 0;
+  if(aux_input == 6) volts = ntc_volts();
+  if(aux_input == 7) volts = sim_voltage() * config.divider;
+  long counts = lround(volts / 5.0 * 1024.0);
+  return counts < 0 ? 0 : counts > 1023 ? 1023 : counts;
+}
+
+
+/////////////////////////////Scheduler hardware layer//////////////////////////////////
+
+void i2c_hw_begin(uint32_t clock_hz)  //the wiring (SimConfig::i2c_hz) may not allow what the firmware asks for
+{
+  bus_hz = clock_hz < config.i2c_hz ? clock_hz : config.i2c_hz;
+}
+
+//Start, address + write bytes, repeated start + address + read bytes, stop. 9 clocks per byte (8 + ack).
+void i2c_hw_start(I2cTransaction &t)
+{
+  uint32_t bytes = 0;
+  uint32_t bits = 2;
+  if(t.tx_len || !t.rx_len) bytes += 1 + t.tx_len;
+  if(t.rx_len){
+    bytes += 1 + t.rx_len;
+    bits += 1;
+  }
+  bits += bytes * 9;
+  uint64_t duration = (uint64_t)bits * 1000000ULL / bus_hz;
+  stats.i2c_transactions++;
+  stats.i2c_bytes += bytes;
+  stats.i2c_busy_us += duration;
+  bus_txn = &t;
+  bus_start_us = now_us;
+  bus_done_us = now_us + duration;
+}
+
+
+const char *sim_lcd_line(uint8_t row)
+{
+  for(int i = 0; i < 16; i++){
+    char c = lcd_ram[row & 1][i];
+    lcd_visible[row & 1][i] = ((uint8_t)c < 8) ? '#' : c;
+  }
+  lcd_visible[row & 1][16] = 0;
+  return lcd_visible[row & 1];
+}
+
+
+/////////////////////////////Front panel//////////////////////////////////
+
+void sim_set_pin(uint8_t pin, bool level)
+{
+  pin_level[pin & 31] = level;
+}
+
+void sim_analog_write(uint8_t pin, int value)
+{
+  if(pin == config.fan_pin){
+    plant_to(now_us);
+    fan_duty = constrain(value, 0, 255);
+  }
+}
+
+void sim_attach_interrupt(uint8_t interrupt, void (*handler)(void), int mode)
+{
+  if(interrupt < 2 && mode == FALLING) int_handler[interrupt] = handler;
+}
+
+bool sim_pin(uint8_t pin)
+{
+  if(config.rdy_pin >= 0 && pin == config.rdy_pin){
+    return !adc_ready;                //ALERT/RDY is active low
+  }
+  return pin_level[pin & 31];
+}
+
+//A clockwise detent moves CLK (D10, PB2) first and DT (D9, PB1) after it, counter clockwise the other way round
+void sim_encoder_step(int direction)
+{
+  uint8_t first = direction > 0 ? 0x04 : 0x02;
+  uint8_t second = direction > 0 ? 0x02 : 0x04;
+  PINB ^= first;
+  PCINT0_vect();
+  sim_advance(500);
+  PINB ^= second;
+  PCINT0_vect();
+  sim_advance(500);
+}
@@ -0,0 +1,101 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/////////////////////////////Host simulation of the electronic load//////////////////////////////////
+/*Used by [env:native]. The firmware in src/ is compiled unchanged against the Arduino core stand-in in this
+  folder. The simulator takes the place of the TWI hardware layer of i2c_bus.cpp and models the devices at bus
+  level: the ADS1115 registers, the MCP4725 write commands and the HD44780 behind the PCF8574 expander see the
+  same bytes the real ones would. Time is simulated: it only moves when the firmware waits (delay) or when the
+  runner charges the CPU time of a loop() pass. Bus transactions and conversions finish at their computed
+  times and run their interrupt handlers (TWI, ALERT/RDY) at that point, so every run is deterministic and
+  independent of the host.
+
+  Electrical model:
+    DAC code -> Vdac = code / 4096 * dac_vref
+    gate drive -> I_demand = gm * (Vdac - vth), clamped at 0, followed by a first order lag (tau_us)
+    the source can only push I_max = Vsrc / (Rsrc + 2 * Rlead + Rshunt) through a fully on MOSFET
+    device voltage Vdev = Vsrc - I * Rsrc, terminal voltage V = Vdev - 2 * I * Rlead (both force leads)
+    AIN0-AIN1 sees I * Rshunt, A7 sees V * divider. AIN2 and AIN3 see the sense terminals, S+ and S-, each
+    through a divider: strapped to the load terminals (V and 0), or leads to the device (V + I * Rlead and
+    -I * Rlead), or S+ off the device (its divider pulls AIN2 to 0)
+    the MOSFET dissipates I * (V - I * Rshunt) into a heatsink with a heat capacity and a thermal resistance
+    to ambient that drops linearly with the fan PWM duty; A6 sees a 10k B3950 NTC under a 10k pullup to 5V */
+
+#define SIM_SENSE_LOCAL   0         //sense terminals strapped to the load terminals
+#define SIM_SENSE_REMOTE  1         //sense leads to the device
+#define SIM_SENSE_OPEN    2         //the S+ lead has come off
+
+struct SimConfig {
+  double source_v;          //open circuit voltage of the device under test (V)
+  double source_r;          //its internal resistance (ohm)
+  double lead_r;            //each force lead from the device to the load terminals (ohm)
+  int sense;                //SIM_SENSE_xxx
+  double shunt_r;           //current sense shunt (ohm)
+  double divider;           //AIN2, AIN3 and A7 = volts * divider (10K/100K = 1/11)
+  double dac_vref;          //MCP4725 full scale (V)
+  double gm;                //DAC volts to load amps (A/V), 1/Rshunt for the op-amp driven MOSFET
+  double vth;               //DAC volts below which the load draws nothing
+  double tau_us;            //first order lag of the load current
+  double adc_noise;         //ADC noise, peak counts (uniform, deterministic)
+  double ambient_c;         //air temperature (C), also the heatsink temperature at reset
+  double heatsink_j_per_c;  //heat capacity of the heatsink and MOSFET (J/C)
+  double heatsink_c_per_w;  //thermal resistance to ambient with the fan off (C/W)
+  double fan_c_per_w;       //the same with the fan at full speed
+  int fan_pin;              //pin whose analogWrite() duty drives the fan
+  uint32_t i2c_hz;          //fastest bus clock the wiring allows, the firmware's clock is capped to it
+  uint32_t loop_us;         //CPU time charged for every loop() pass, the same for all of them
+  int rdy_pin;              //pin wired to ADS1115 ALERT/RDY, -1 if not wired
+  uint32_t seed;            //noise generator seed
+};
+
+struct SimStats {
+  uint32_t loops;           //loop() passes
+  uint32_t i2c_transactions;
+  uint32_t i2c_bytes;       //including address bytes
+  uint32_t i2c_busy_us;     //time the bus spent clocking
+  uint32_t adc_conversions;
+  uint32_t dac_writes;
+  uint32_t lcd_bytes;       //bytes sent to the HD44780 (commands and data)
+  uint32_t lcd_timing_errors; //nibbles latched while the HD44780 was still busy with the last command
+  uint32_t uart_bytes;      //bytes sent by the UART
+  uint32_t eeprom_writes;   //EEPROM bytes actually written
+};
+
+SimConfig sim_default_config();
+void sim_reset(const SimConfig &config);      //time 0, plant off, pins released
+SimConfig &sim_config();                      //live config, changes apply from the next plant step
+const SimStats &sim_stats();
+
+uint64_t sim_time_us();
+void sim_advance(uint64_t us);                //move time forward, running bus and conversion events on the way
+void sim_run_loop();                          //one loop() pass plus its CPU time
+
+//Plant observation
+double sim_current();                         //load current (A)
+double sim_voltage();                         //terminal voltage (V)
+double sim_device_voltage();                  //voltage at the device, past the force leads (V)
+uint16_t sim_dac_code();
+double sim_heatsink();                        //heatsink temperature (C)
+uint8_t sim_fan();                            //fan PWM duty, 0-255
+
+//Front panel
+void sim_set_pin(uint8_t pin, bool level);    //buttons are active low, released = HIGH
+void sim_encoder_step(int direction);         //one detent, +1 clockwise
+const char *sim_lcd_line(uint8_t row);        //the 16 visible characters of a row, custom chars shown as '#'
+
+//Serial port
+size_t sim_uart_take(uint8_t *buf, size_t len);   //bytes sent since the last call (the last 64K are kept)
+void sim_uart_send(const char *text);             //received by the firmware at the configured baud rate
+
+//EEPROM (kept across sim_reset, erased to 0xFF at the first one)
+void sim_eeprom_erase();
+
+//Hooks used by the core stand-in
+bool sim_pin(uint8_t pin);                    //level seen by digitalRead()
+void sim_analog_write(uint8_t pin, int value);
+void sim_attach_interrupt(uint8_t interrupt, void (*handler)(void), int mode);
+
+#endif
@@ -0,0 +1,48 @@
+//Runner for [env:native]: runs setup() and loop() in simulated time and prints the LCD whenever it changes.
+//Usage: program [seconds] [source volts] [source ohms]
+//Builds that bring their own main() (the benchmark) define SIM_NO_MAIN.
+
+#ifndef SIM_NO_MAIN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+void setup();
+
+int main(int argc, char **argv)
+{
+  SimConfig config = sim_default_config();
+  double seconds = 5;
+  if(argc > 1) seconds = atof(argv[1]);
+  if(argc > 2) config.source_v = atof(argv[2]);
+  if(argc > 3) config.source_r = atof(argv[3]);
+  sim_reset(config);
+
+  setup();
+  uint64_t start_us = sim_time_us();
+  uint64_t end_us = start_us + (uint64_t)(seconds * 1e6);
+  uint32_t start_loops = sim_stats().loops;
+
+  char shown[2][17] = {"", ""};
+  while(sim_time_us() < end_us){
+    sim_run_loop();
+    if(strcmp(shown[0], sim_lcd_line(0)) || strcmp(shown[1], sim_lcd_line(1))){
+      strcpy(shown[0], sim_lcd_line(0));
+      strcpy(shown[1], sim_lcd_line(1));
+      printf("%9.3f s  |%s|  |%s|\n", sim_time_us() / 1e6, shown[0], shown[1]);
+    }
+  }
+
+  const SimStats &stats = sim_stats();
+  double run_s = (sim_time_us() - start_us) / 1e6;
+  printf("loops/s %.1f  adc conversions %u  dac writes %u  i2c bytes %u  bus busy %.1f%%  lcd bytes %u"
+         "  lcd timing errors %u\n",
+         (stats.loops - start_loops) / run_s, stats.adc_conversions, stats.dac_writes,
+         stats.i2c_bytes, stats.i2c_busy_us / 1e4 / (sim_time_us() / 1e6), stats.lcd_bytes,
+         stats.lcd_timing_errors);
+  return 0;
+}
+
+#endif
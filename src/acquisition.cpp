@@ -0,0 +1,331 @@
+#include "acquisition.h"
+#include "ads1115.h"
+#include "protect.h"
+
+extern Ads1115 ads;
+
+//Channels visited by the engine. Slot 0 is the current, slot 1 the voltage: AIN2 alone, or AIN2-AIN3 with
+//remote sense (acq_set_remote).
+static uint16_t acq_mux[2] = {ADS1115_MUX_DIFF_0_1, ADS1115_MUX_SINGLE_2};
+
+//PGA setting of each range and its nominal size in fine counts per count, 32 * FSR / 6.144V, in Q(10 + range):
+//each range halves the count, so one more fraction bit per range keeps every scale at 16 bits of precision
+static const uint16_t acq_gain[ACQ_RANGES] = {GAIN_TWOTHIRDS, GAIN_ONE, GAIN_TWO, GAIN_FOUR, GAIN_EIGHT, GAIN_SIXTEEN};
+static const uint16_t acq_nominal[ACQ_RANGES] = {32768, 43691, 43691, 43691, 43691, 43691};
+
+static uint16_t acq_scales[2][ACQ_RANGES] = {   //nominal corrected by the trims
+  {32768, 43691, 43691, 43691, 43691, 43691},
+  {32768, 43691, 43691, 43691, 43691, 43691},
+};
+static int16_t acq_trims[2][ACQ_RANGES];
+static uint8_t acq_next_range[2] = {0, 0};        //range for the next conversion of the current and the voltage
+
+static volatile uint8_t acq_slot = 0;             //channel being converted right now
+static volatile uint8_t acq_read_slot = 0;        //channel whose result is being read
+static uint8_t acq_range_now = 0;                 //range of the conversion running
+static uint8_t acq_read_range = 0;                //range of the result being read
+static volatile bool acq_running = false;         //a conversion was started and not collected yet
+static volatile unsigned long acq_start_us = 0;   //micros() when that conversion was started
+static unsigned long acq_conv_us = 0;             //nominal conversion time plus margin
+static int32_t acq_pending_current = 0;           //current half of the pair being built
+static int16_t acq_pending_raw = 0;
+static uint8_t acq_pending_range = 0;
+static bool acq_pending_clipped = false;          //the pair being built is lost
+static uint8_t acq_voltage_stale = 0;             //voltage results still to come from the input before acq_set_remote()
+static AcqSample acq_last = {0, 0, 0, 0, 0, 0, 0, 0};
+static volatile bool acq_new = false;
+static volatile uint8_t acq_pairs = 0;            //pairs started, wraps
+static bool acq_aux_running = false;              //a conversion of the ATmega's ADC is running
+static uint8_t acq_aux_input = 0;                 //of that input
+static uint8_t acq_temp_pairs = 0;                //acq_pairs when the last NTC conversion was started
+#if ACQ_TERMINAL_INPUT >= 0
+static uint8_t acq_terminal_pairs = 0;            //the same for the terminals
+#endif
+static int16_t acq_temp_raw = 0;
+static bool acq_temp_new = false;
+static int16_t acq_terminal_raw = 0;
+static bool acq_terminal_new = false;
+
+
+//Conversion time in us for a RATE_ADS1115_xxSPS value. The internal oscillator is only +/-10% so we add 10%.
+static unsigned long acq_conversion_time(uint16_t rate)
+{
+  static const uint16_t sps[8] = {8, 16, 32, 64, 128, 250, 475, 860};
+  return 1100000UL / sps[(rate >> 5) & 0x07];
+}
+
+//Fine counts of `raw` counts in `range`
+static int32_t acq_fine(uint8_t channel, uint8_t range, int16_t raw)
+{
+  uint8_t shift = 10 + range;
+  return ((int32_t)raw * acq_scales[channel][range] + ((int32_t)1 << (shift - 1))) >> shift;
+}
+
+//Counts at the GAIN_TWOTHIRDS range, what the protection limits are worked out for
+static int16_t acq_coarse(int32_t fine)
+{
+  fine >>= FINE_SHIFT;
+  return fine > 32767 ? 32767 : fine < -32768 ? -32768 : fine;
+}
+
+//Range for the next conversion of `channel` after a result of `raw` counts (`fine` fine counts) in `range`
+static uint8_t acq_pick_range(uint8_t channel, uint8_t range, int16_t raw, int32_t fine)
+{
+  if(raw == 32767 || raw == -32768) return 0;       //clipped: anything is possible, start from the top
+  if(range > 0 && (raw > ACQ_RANGE_DOWN || raw < -ACQ_RANGE_DOWN)) return range - 1;
+  if(range < ACQ_RANGES - 1){
+    int32_t fits = acq_fine(channel, range + 1, ACQ_RANGE_UP);
+    if(fine < fits && fine > -fits) return range + 1;
+  }
+  return range;
+}
+
+//Callbacks, run from the TWI interrupt
+static void acq_on_started(I2cTransaction &)
+{
+  acq_start_us = micros();
+  acq_running = true;
+}
+
+static void acq_on_result(I2cTransaction &)
+{
+  int16_t raw = ads.lastResult();
+  uint8_t slot = acq_read_slot;
+  if(slot == 1 && acq_voltage_stale){
+    acq_voltage_stale--;
+    return;                                         //pair lost, like a clipped one
+  }
+  uint8_t range = acq_read_range;
+  int32_t fine = acq_fine(slot, range, raw);
+  bool clipped = range > 0 && (raw == 32767 || raw == -32768);   //in the coarsest range it is a real overload
+  acq_next_range[slot] = acq_pick_range(slot, range, raw, fine);
+  if(slot == 0){
+    acq_pending_current = fine;
+    acq_pending_raw = raw;
+    acq_pending_range = range;
+    acq_pending_clipped = clipped;
+    //limits on every result, before loop() sees it. A clipped result is the full scale of its range, less
+    //than the real current, so a limit it is over is really over.
+    protect_check(acq_coarse(fine), acq_coarse(acq_last.voltage));
+    return;
+  }
+  if(clipped || acq_pending_clipped){               //a clipped voltage is not checked, it could look under UVP
+    if(!clipped) protect_check(acq_coarse(acq_last.current), acq_coarse(fine));
+    return;                                         //pair lost, the next one comes in the right ranges
+  }
+  protect_check(acq_coarse(acq_pending_current), acq_coarse(fine));
+  acq_last.current = acq_pending_current;
+  acq_last.voltage = fine;
+  acq_last.current_raw = acq_pending_raw;
+  acq_last.voltage_raw = raw;
+  acq_last.current_range = acq_pending_range;
+  acq_last.voltage_range = range;
+  acq_last.stamp_us = micros();
+  acq_last.seq++;
+  acq_new = true;
+}
+
+//Slot after `slot`: current, voltage, current, voltage ...
+static uint8_t acq_next(uint8_t slot)
+{
+  if(slot == 0) return 1;
+  acq_pairs++;
+  return 0;
+}
+
+//End of a conversion: restart the converter on the next channel first, then fetch the finished result
+static void acq_collect()
+{
+  acq_running = false;
+  acq_read_slot = acq_slot;
+  acq_read_range = acq_range_now;
+  acq_slot = acq_next(acq_slot);
+  acq_range_now = acq_next_range[acq_slot];
+  ads.setGain(acq_gain[acq_range_now]);
+  ads.startConversion(acq_mux[acq_slot], acq_on_started);
+  ads.readConversion(acq_on_result);
+}
+
+#if ACQ_RDY_PIN >= 0
+static void acq_rdy_isr()
+{
+  acq_collect();
+}
+#endif
+
+
+void acq_begin()
+{
+  acq_set_data_rate(ACQ_DATA_RATE);
+  #if ACQ_RDY_PIN >= 0
+    pinMode(ACQ_RDY_PIN, INPUT_PULLUP);         //ALERT/RDY is open drain
+    attachInterrupt(digitalPinToInterrupt(ACQ_RDY_PIN), acq_rdy_isr, FALLING);
+  #endif
+  acq_slot = 0;
+  acq_temp_pairs = acq_pairs - ACQ_TEMP_PAIRS;  //the temperature and the terminals come first
+  #if ACQ_TERMINAL_INPUT >= 0
+    acq_terminal_pairs = acq_pairs - ACQ_TERMINAL_PAIRS;
+  #endif
+  acq_range_now = acq_next_range[0];
+  acq_start_us = micros();
+  ads.setGain(acq_gain[acq_range_now]);
+  ads.startConversion(acq_mux[0], acq_on_started);
+}
+
+void acq_set_data_rate(uint16_t rate)
+{
+  ads.setDataRate(rate);
+  acq_conv_us = acq_conversion_time(rate);
+}
+
+//The ATmega's ADC: collect a finished conversion, then start the one that is due
+static void acq_aux_poll()
+{
+  if(acq_aux_running){
+    if(acq_hw_aux_busy()) return;
+    acq_aux_running = false;
+    if(acq_aux_input == ACQ_NTC_INPUT){
+      acq_temp_raw = acq_hw_aux_result();
+      acq_temp_new = true;
+    }
+    else{
+      acq_terminal_raw = acq_hw_aux_result();
+      acq_terminal_new = true;
+    }
+  }
+  uint8_t pairs = acq_pairs;
+  if((uint8_t)(pairs - acq_temp_pairs) >= ACQ_TEMP_PAIRS){
+    acq_temp_pairs = pairs;
+    acq_aux_input = ACQ_NTC_INPUT;
+  }
+#if ACQ_TERMINAL_INPUT >= 0
+  else if((uint8_t)(pairs - acq_terminal_pairs) >= ACQ_TERMINAL_PAIRS){
+    acq_terminal_pairs = pairs;
+    acq_aux_input = ACQ_TERMINAL_INPUT;
+  }
+#endif
+  else return;
+  acq_hw_aux_start(acq_aux_input);
+  acq_aux_running = true;
+}
+
+bool acq_poll()
+{
+  acq_aux_poll();
+  uint8_t sreg = SREG;
+  cli();
+  unsigned long elapsed = micros() - acq_start_us;
+  #if ACQ_RDY_PIN < 0
+    if(acq_running && elapsed >= acq_conv_us){
+      acq_collect();
+    }
+  #endif
+  if(elapsed > 4 * acq_conv_us + 2000){         //a start was lost (bus error): kick the pipeline again
+    acq_start_us = micros();
+    acq_collect();
+  }
+  bool fresh = acq_new;
+  acq_new = false;
+  SREG = sreg;
+  return fresh;
+}
+
+void acq_latest(AcqSample &sample)
+{
+  uint8_t sreg = SREG;
+  cli();
+  sample = acq_last;
+  SREG = sreg;
+}
+
+bool acq_temperature(int16_t &raw)
+{
+  bool fresh = acq_temp_new;
+  acq_temp_new = false;
+  raw = acq_temp_raw;
+  return fresh;
+}
+
+bool acq_terminal(int16_t &raw)
+{
+  bool fresh = acq_terminal_new;
+  acq_terminal_new = false;
+  raw = acq_terminal_raw;
+  return fresh;
+}
+
+void acq_set_remote(bool remote)
+{
+  uint16_t mux = remote ? ADS1115_MUX_DIFF_2_3 : ADS1115_MUX_SINGLE_2;
+  uint8_t sreg = SREG;                  //the interrupt starts the conversions
+  cli();
+  if(acq_mux[1] != mux){
+    acq_mux[1] = mux;
+    acq_voltage_stale = 1;              //the one running may still be on the old input
+  }
+  SREG = sreg;
+}
+
+bool acq_remote()
+{
+  return acq_mux[1] == ADS1115_MUX_DIFF_2_3;
+}
+
+uint8_t acq_range(uint8_t channel)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t range = channel == ACQ_CURRENT ? acq_last.current_range : acq_last.voltage_range;
+  SREG = sreg;
+  return range;
+}
+
+void acq_set_trim(uint8_t channel, uint8_t range, int16_t trim)
+{
+  if(channel > ACQ_VOLTAGE || range == 0 || range >= ACQ_RANGES) return;
+  trim = constrain(trim, -ACQ_TRIM_MAX, ACQ_TRIM_MAX);
+  uint16_t scale = acq_nominal[range] + (((int32_t)acq_nominal[range] * trim) >> 15);
+  uint8_t sreg = SREG;                  //the interrupt reads it
+  cli();
+  acq_trims[channel][range] = trim;
+  acq_scales[channel][range] = scale;
+  SREG = sreg;
+}
+
+int16_t acq_trim(uint8_t channel, uint8_t range)
+{
+  return channel <= ACQ_VOLTAGE && range < ACQ_RANGES ? acq_trims[channel][range] : 0;
+}
+
+bool acq_calibrate(uint8_t channel, int32_t actual, int32_t measured)
+{
+  uint8_t range = acq_range(channel);
+  if(channel > ACQ_VOLTAGE || range == 0 || measured <= 0) return false;
+  int32_t scale = (int64_t)acq_scales[channel][range] * actual / measured;
+  int32_t trim = ((scale - acq_nominal[range]) << 15) / acq_nominal[range];
+  if(trim < -ACQ_TRIM_MAX || trim > ACQ_TRIM_MAX) return false;
+  acq_set_trim(channel, range, trim);
+  return true;
+}
+
+
+
+#ifdef __AVR__
+/////////////////////////////ATmega ADC hardware layer//////////////////////////////////
+
+void acq_hw_aux_start(uint8_t input)
+{
+  ADMUX = _BV(REFS0) | (input & 0x07);  //AVcc reference, right adjusted
+  ADCSRA |= _BV(ADSC);                  //enabled at clock / 128 (104us a conversion) by the Arduino core
+}
+
+bool acq_hw_aux_busy()
+{
+  return ADCSRA & _BV(ADSC);
+}
+
+uint16_t acq_hw_aux_result()
+{
+  return ADC;
+}
+#endif
@@ -0,0 +1,66 @@
+#include "ads1115.h"
+
+#define REG_CONVERSION  0x00
+#define REG_CONFIG      0x01
+#define REG_LO_THRESH   0x02
+#define REG_HI_THRESH   0x03
+
+#define CONFIG_OS_SINGLE    0x8000    //start a conversion
+#define CONFIG_MODE_SINGLE  0x0100    //power down after it
+#define CONFIG_CQUE_1CONV   0x0000    //comparator on, needed for ALERT/RDY; polarity active low
+
+void Ads1115::writeRegister(uint8_t reg, uint16_t value)
+{
+  start_txn.address = address;
+  start_txn.tx_len = 3;
+  start_txn.rx_len = 0;
+  start_txn.tx[0] = reg;
+  start_txn.tx[1] = value >> 8;
+  start_txn.tx[2] = value & 0xFF;
+  start_txn.done = 0;
+  i2c_submit(start_txn, I2C_PRIO_HIGH);
+  i2c_wait(start_txn);
+}
+
+void Ads1115::begin(uint8_t i2c_address)
+{
+  address = i2c_address;
+  //HI_THRESH MSB set and LO_THRESH MSB clear turn ALERT/RDY into a conversion ready output
+  writeRegister(REG_HI_THRESH, 0x8000);
+  writeRegister(REG_LO_THRESH, 0x0000);
+}
+
+bool Ads1115::startConversion(uint16_t mux, I2cCallback started)
+{
+  if(i2c_pending(start_txn)){
+    return false;
+  }
+  uint16_t config = CONFIG_OS_SINGLE | mux | gain_bits | CONFIG_MODE_SINGLE | rate_bits | CONFIG_CQUE_1CONV;
+  start_txn.address = address;
+  start_txn.tx_len = 3;
+  start_txn.rx_len = 0;
+  start_txn.tx[0] = REG_CONFIG;
+  start_txn.tx[1] = config >> 8;
+  start_txn.tx[2] = config & 0xFF;
+  start_txn.done = started;
+  return i2c_submit(start_txn, I2C_PRIO_HIGH);
+}
+
+bool Ads1115::readConversion(I2cCallback done)
+{
+  if(i2c_pending(read_txn)){
+    return false;
+  }
+  read_txn.address = address;
+  read_txn.tx_len = 1;
+  read_txn.rx_len = 2;
+  read_txn.tx[0] = REG_CONVERSION;
+  read_txn.rx = result;
+  read_txn.done = done;
+  return i2c_submit(read_txn, I2C_PRIO_HIGH);
+}
+
+int16_t Ads1115::lastResult()
+{
+  return (int16_t)(((uint16_t)result[0] << 8) | result[1]);
+}
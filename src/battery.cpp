@@ -0,0 +1,75 @@
+#include "battery.h"
+
+static uint64_t charge_mAus = 0;        //mA * us = nC
+static uint64_t energy_uWus = 0;        //uW * us = pJ
+static uint64_t on_us = 0;
+static unsigned long last_stamp = 0;
+static bool have_stamp = false;
+static uint8_t below = 0;
+static bool ended = false;
+
+void batt_start()
+{
+  charge_mAus = 0;
+  energy_uWus = 0;
+  on_us = 0;
+  have_stamp = false;
+  below = 0;
+  ended = false;
+}
+
+bool batt_sample(unsigned long stamp_us, long mA, long mV, long cutoff_mV, bool load_on)
+{
+  unsigned long dt = stamp_us - last_stamp;     //wraps correctly every 71 minutes
+  bool first = !have_stamp;
+  last_stamp = stamp_us;
+  have_stamp = true;
+  if(!first && load_on && !ended){
+    if(mA > 0){
+      charge_mAus += (uint64_t)(uint32_t)mA * dt;
+      if(mV > 0){
+        energy_uWus += (uint64_t)(uint32_t)(mA * mV) * dt;
+      }
+    }
+    on_us += dt;
+  }
+
+  if(mV < cutoff_mV){
+    if(below < BATT_TRIP_SAMPLES) below++;
+    if(below >= BATT_TRIP_SAMPLES && load_on) ended = true;
+  }
+  else{
+    below = 0;
+  }
+  return !ended;
+}
+
+bool batt_ended()
+{
+  return ended;
+}
+
+bool batt_can_resume(long mV, long cutoff_mV)
+{
+  if(mV < cutoff_mV + BATT_HYSTERESIS_mV){
+    return false;
+  }
+  ended = false;
+  below = 0;
+  return true;
+}
+
+uint32_t batt_uAh()
+{
+  return charge_mAus / 3600000ULL;              //1 uAh = 1 mA * 3.6e6 us
+}
+
+uint32_t batt_uWh()
+{
+  return energy_uWus / 3600000000ULL;           //1 uWh = 1 uW * 3.6e9 us
+}
+
+uint32_t batt_seconds()
+{
+  return on_us / 1000000UL;
+}
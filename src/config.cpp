@@ -0,0 +1,113 @@
+#include "config.h"
+#include "nvm.h"
+#include "crc.h"
+
+#define CONFIG_HEADER   3               //version, sequence number
+#define CONFIG_RECORD   (CONFIG_HEADER + sizeof(Config) + 2)
+
+static uint16_t sequence = 0;           //of the newest record
+static uint8_t slot = CONFIG_SLOTS - 1; //where it is
+static uint16_t saved_crc = 0;          //CRC of the Config in it
+static bool have_saved = false;
+static bool pending = false;            //a changed Config is waiting to stay the same for CONFIG_SAVE_MS
+static uint16_t pending_crc = 0;
+static unsigned long pending_since = 0;
+static unsigned long last_check = 0;
+
+static Config saving;                   //copy being written, so it can not change halfway
+static uint8_t write_pos = CONFIG_RECORD;
+static uint16_t write_crc = 0;
+
+
+static uint16_t slot_address(uint8_t n)
+{
+  return CONFIG_EEPROM_ADDR + (uint16_t)n * CONFIG_SLOT_BYTES;
+}
+
+//Byte `pos` of the record being written. The CRC goes last and covers what was actually written.
+static uint8_t record_byte(uint8_t pos)
+{
+  if(pos == 0) return CONFIG_VERSION;
+  if(pos == 1) return sequence & 0xFF;
+  if(pos == 2) return sequence >> 8;
+  if(pos < CONFIG_HEADER + sizeof(Config)) return ((const uint8_t *)&saving)[pos - CONFIG_HEADER];
+  return pos == CONFIG_RECORD - 2 ? write_crc & 0xFF : write_crc >> 8;
+}
+
+bool config_load(Config &config)
+{
+  bool found = false;
+  Config candidate;
+  for(uint8_t n = 0; n < CONFIG_SLOTS; n++){
+    uint8_t header[CONFIG_HEADER];
+    uint8_t stored[2];
+    uint16_t address = slot_address(n);
+    nvm_read(address, header, CONFIG_HEADER);
+    if(header[0] != CONFIG_VERSION) continue;
+    nvm_read(address + CONFIG_HEADER, &candidate, sizeof(Config));
+    nvm_read(address + CONFIG_HEADER + sizeof(Config), stored, 2);
+    uint16_t crc = crc_block(crc_block(0xFFFF, header, CONFIG_HEADER), &candidate, sizeof(Config));
+    if(crc != (stored[0] | (stored[1] << 8))) continue;
+    uint16_t seq = header[1] | (header[2] << 8);
+    if(found && (int16_t)(seq - sequence) <= 0) continue;     //wraps after 65536 saves
+    found = true;
+    sequence = seq;
+    slot = n;
+    config = candidate;
+  }
+  if(found){
+    saved_crc = crc_block(0xFFFF, &config, sizeof(Config));
+    have_saved = true;
+  }
+  return found;
+}
+
+bool config_due()
+{
+  unsigned long now = millis();
+  if(now - last_check < CONFIG_CHECK_MS) return false;
+  last_check = now;
+  return true;
+}
+
+void config_write()
+{
+  while(write_pos < CONFIG_RECORD && nvm_free() > NVM_RESERVE){
+    uint8_t b = record_byte(write_pos);
+    nvm_write(slot_address(slot) + write_pos, &b, 1);
+    if(write_pos < CONFIG_RECORD - 2) write_crc = crc_update(write_crc, b);
+    write_pos++;
+  }
+}
+
+void config_poll(const Config &config)
+{
+  if(write_pos < CONFIG_RECORD) return;
+
+  uint16_t crc = crc_block(0xFFFF, &config, sizeof(Config));
+  if(have_saved && crc == saved_crc){
+    pending = false;
+    return;
+  }
+  if(!pending || crc != pending_crc){
+    pending = true;
+    pending_crc = crc;
+    pending_since = millis();
+    return;
+  }
+  if(millis() - pending_since < CONFIG_SAVE_MS) return;
+
+  saving = config;                      //next slot in turn, the newest record stays valid until this one is
+  slot = (slot + 1) % CONFIG_SLOTS;
+  sequence++;
+  write_pos = 0;
+  write_crc = 0xFFFF;
+  saved_crc = crc;
+  have_saved = true;
+  pending = false;
+}
+
+bool config_saving()
+{
+  return write_pos < CONFIG_RECORD;
+}
@@ -0,0 +1,76 @@
+#include "cv.h"
+#include "regulator.h"
+
+static int32_t target_q8 = 0;           //target current, Q8 mA
+static uint32_t r_mohm = CV_R_START_mohm;
+static bool have_r = false;             //r_mohm was measured
+static long ref_mV = 0, ref_mA = 0;     //operating point of the last estimate
+static bool have_ref = false;
+static bool probing = false;
+static uint8_t probe_count = 0;
+
+void cv_start(long mA)
+{
+  target_q8 = (int32_t)mA << 8;
+  r_mohm = CV_R_START_mohm;
+  have_r = false;
+  have_ref = false;
+  probing = true;
+  probe_count = 0;
+}
+
+//-dV/dI since the last reference point, once the current or the voltage has moved far enough for the noise
+//not to matter. True when there is a new estimate.
+static bool cv_estimate(long mV, long mA)
+{
+  if(!have_ref){
+    ref_mV = mV;
+    ref_mA = mA;
+    have_ref = true;
+    return false;
+  }
+  long di = mA - ref_mA;
+  long dv = ref_mV - mV;
+  if(abs(di) < CV_R_STEP_mA && (abs(dv) < CV_R_STEP_mV || abs(di) < CV_R_MIN_STEP_mA)) return false;
+  ref_mV = mV;
+  ref_mA = mA;
+  if(dv == 0 || (dv > 0) != (di > 0)){    //more current but no lower voltage: noise, keep the estimate
+    return false;
+  }
+  uint32_t r = (uint32_t)(abs(dv) * 1000L) / (uint32_t)abs(di);
+  if(r > CV_R_MAX_mohm) r = CV_R_MAX_mohm;
+  if(have_r && r < r_mohm / 4) r = r_mohm / 4;
+  if(r < CV_R_MIN_mohm) r = CV_R_MIN_mohm;
+  r_mohm = r;
+  have_r = true;
+  return true;
+}
+
+long cv_update(long setpoint_mV, long mV, long mA)
+{
+  bool estimated = cv_estimate(mV, mA);
+  if(probing){                            //doubling steps of current until the first estimate
+    if(estimated || mV <= setpoint_mV){
+      probing = false;
+    }
+    else{
+      if(++probe_count >= CV_PROBE_SAMPLES){
+        probe_count = 0;
+        target_q8 = target_q8 ? target_q8 * 2 : (int32_t)CV_PROBE_mA << 8;
+        target_q8 = target_q8 > ((int32_t)MAX_SETPOINT_mA << 8) ? ((int32_t)MAX_SETPOINT_mA << 8) : target_q8;
+      }
+      return (target_q8 + 128) >> 8;
+    }
+  }
+  long error = mV - setpoint_mV;                          //above the setpoint: more current
+  error = constrain(error, -60000L, 60000L);
+  target_q8 += (error * 1000L * CV_GAIN) / (long)r_mohm;  //mA to move the voltage by `error` times the gain, Q8:
+                                                          //below 2^31 for the +/-60V clamp
+  target_q8 = constrain(target_q8, 0L, (long)MAX_SETPOINT_mA << 8);
+  return (target_q8 + 128) >> 8;
+}
+
+uint32_t cv_resistance()
+{
+  return r_mohm;
+}
@@ -0,0 +1,68 @@
+#include "display.h"
+
+FrameBuffer::FrameBuffer(Lcd &lcd) : lcd(lcd)
+{
+  memset(frame, ' ', sizeof(frame));
+  memset(shown, ' ', sizeof(shown));
+  col = row = 0;
+  lcd_col = lcd_row = -1;
+}
+
+void FrameBuffer::clear()
+{
+  memset(frame, ' ', sizeof(frame));
+  col = row = 0;
+}
+
+void FrameBuffer::setCursor(uint8_t c, uint8_t r)
+{
+  col = c;
+  row = r < DISPLAY_ROWS ? r : DISPLAY_ROWS - 1;
+}
+
+size_t FrameBuffer::write(uint8_t value)
+{
+  if(col < DISPLAY_COLS){               //like the LCD, text past the edge is not visible
+    frame[row][col] = value;
+  }
+  col++;
+  return 1;
+}
+
+void FrameBuffer::invalidate()
+{
+  lcd.clear();
+  memset(shown, ' ', sizeof(shown));
+  lcd_col = lcd_row = 0;
+}
+
+bool FrameBuffer::refresh()
+{
+  uint8_t budget = lcd.freeSlots();
+  for(uint8_t r = 0; r < DISPLAY_ROWS; r++){
+    for(uint8_t c = 0; c < DISPLAY_COLS; c++){
+      if(frame[r][c] == shown[r][c]){
+        continue;
+      }
+      //Rewriting one unchanged cell costs the same as a cursor move, so only jump over gaps of 2 or more
+      if(lcd_row != r || lcd_col < 0 || lcd_col > c || c - lcd_col > 1){
+        if(budget == 0) return false;
+        lcd.setCursor(c, r);
+        budget--;
+        lcd_col = c;
+        lcd_row = r;
+      }
+      while(lcd_col <= c){
+        if(budget == 0) return false;
+        lcd.write(frame[r][lcd_col]);
+        shown[r][lcd_col] = frame[r][lcd_col];
+        budget--;
+        lcd_col++;
+      }
+      if(lcd_col >= DISPLAY_COLS){        //the HD44780 carries on into invisible DDRAM, not the next row
+        lcd_col = -1;
+      }
+    }
+  }
+  return true;
+}
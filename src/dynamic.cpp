@@ -0,0 +1,141 @@
+#include "dynamic.h"
+#include "tick.h"
+#include "regulator.h"
+#include "mcp4725.h"
+#include "feedforward.h"
+
+extern Mcp4725 dac;
+
+//Settings, written by loop() with interrupts off
+static volatile int16_t level_code[2];
+static volatile uint16_t period_ms = 100;
+static volatile uint16_t high_ms = 50;
+static volatile int16_t step_code = PID_DAC_MAX;
+static volatile bool running = false;
+
+//Interrupt state, read by loop() with interrupts off
+static uint16_t phase = 0;
+static int16_t out_code = 0;
+static volatile uint8_t out_level = 0;
+static volatile uint8_t steady_ms = 0;
+
+//loop() side
+static Pid level_pid[2];
+static long level_mA[2] = {-1, -1};
+static long config_freq = -1, config_slew = -1;
+static uint8_t config_duty = 0;
+
+
+//Timer interrupt, every ms
+static void dyn_tick()
+{
+  int16_t target = 0;
+  if(running){
+    if(++phase >= period_ms) phase = 0;
+    uint8_t level = phase < high_ms ? 0 : 1;
+    if(level != out_level){
+      out_level = level;
+      steady_ms = 0;
+    }
+    target = level_code[level];
+  }
+  else{
+    phase = 0;
+    steady_ms = 0;
+  }
+
+  if(out_code != target){
+    int16_t diff = target - out_code;
+    if(!running){
+      //off or paused: no ramp, the load goes off at once
+    }
+    else if(diff > step_code){
+      diff = step_code;
+      steady_ms = 0;                  //still ramping
+    }
+    else if(diff < -step_code){
+      diff = -step_code;
+      steady_ms = 0;
+    }
+    out_code += diff;
+    dac.setVoltage(out_code, false);  //queued on the I2C scheduler, returns at once
+  }
+  if(steady_ms < 255) steady_ms++;
+}
+
+void dyn_start()
+{
+  uint8_t sreg = SREG;
+  cli();
+  running = false;
+  phase = 0;
+  out_code = 0;
+  steady_ms = 0;
+  SREG = sreg;
+  level_mA[0] = level_mA[1] = -1;     //the next dyn_configure() seeds the trims
+  config_freq = config_slew = -1;
+  tick_start(dyn_tick);
+}
+
+void dyn_stop()
+{
+  tick_stop();
+  running = false;
+}
+
+void dyn_configure(long level1_mA, long level2_mA, long freq_mHz, uint8_t duty, long slew_mA_per_ms, bool on)
+{
+  long levels[2] = {level1_mA, level2_mA};
+  bool levels_changed = false;
+  for(uint8_t i = 0; i < 2; i++){
+    if(levels[i] != level_mA[i]){     //new level: start again from the feed-forward estimate
+      level_mA[i] = levels[i];
+      levels_changed = true;
+      pid_init(level_pid[i], PID_KP, PID_KI, PID_KD);
+      pid_bumpless(level_pid[i], ff_dac(levels[i]));
+      uint8_t sreg = SREG;
+      cli();
+      level_code[i] = ff_dac(levels[i]);
+      SREG = sreg;
+    }
+  }
+
+  if(freq_mHz != config_freq || duty != config_duty || slew_mA_per_ms != config_slew || levels_changed){
+    config_freq = freq_mHz;
+    config_duty = duty;
+    config_slew = slew_mA_per_ms;
+    long period = freq_mHz > 0 ? 1000000L / freq_mHz : 60000L;
+    period = constrain(period, (long)DYN_MIN_PERIOD_MS, 60000L);
+    long high = period * duty / 100;
+    high = constrain(high, 1L, period - 1);
+    //A rate takes the table's slope where the ramp ends at the higher level, not ff_dac() of it: below the
+    //lowest point the MOSFET may not conduct yet, and that offset would make the ramp several times too fast
+    long top = level_mA[0] > level_mA[1] ? level_mA[0] : level_mA[1];
+    long step = slew_mA_per_ms > 0 ? ff_dac_step(top, slew_mA_per_ms) : PID_DAC_MAX;
+    if(step < 1) step = 1;
+    uint8_t sreg = SREG;
+    cli();
+    period_ms = period;
+    high_ms = high;
+    step_code = step;
+    SREG = sreg;
+  }
+
+  running = on;
+}
+
+void dyn_trim(long measured_mA)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint8_t level = out_level;
+  bool steady = running && steady_ms >= DYN_SETTLE_MS;
+  SREG = sreg;
+  if(!steady){
+    return;
+  }
+  int16_t code = pid_update(level_pid[level], constrain(level_mA[level], 0L, (long)MAX_SETPOINT_mA), measured_mA);
+  cli();
+  level_code[level] = code;
+  SREG = sreg;
+}
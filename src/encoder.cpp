@@ -0,0 +1,51 @@
+#include "encoder.h"
+
+#define ENC_PINS()          ((PINB >> 1) & 0x03)    //bit 1 = CLK (PB2), bit 0 = DT (PB1)
+#define ENC_TRANSITIONS     2                       //valid transitions per detent
+
+//Clockwise is 11 -> 01 -> 00 -> 10 -> 11, index is previous state * 4 + new state
+static const int8_t enc_table[16] = {
+   0, -1, +1,  0,
+  +1,  0,  0, -1,
+  -1,  0,  0, +1,
+   0, +1, -1,  0
+};
+
+static uint8_t enc_state;                     //last CLK/DT state, only touched by the interrupt
+static int8_t enc_sub;                        //transitions towards the next step
+static volatile uint8_t enc_ticks;            //free running step counter, wraps
+static uint8_t enc_ticks_seen;                //main loop copy
+
+void encoder_begin()
+{
+  DDRB &= B11111001;                          //Pins 9, 10 as input
+  enc_state = ENC_PINS();
+  enc_sub = 0;
+  enc_ticks_seen = enc_ticks;
+  PCICR |= (1 << PCIE0);                      //enable PCMSK0 scan
+  PCMSK0 |= (1 << PCINT1);                    //Pin 9 (DT) interrupt on state change
+  PCMSK0 |= (1 << PCINT2);                    //Pin 10 (CLK) interrupt on state change
+}
+
+int8_t encoder_read()
+{
+  uint8_t ticks = enc_ticks;                  //single byte: atomic without cli()
+  int8_t steps = (int8_t)(ticks - enc_ticks_seen);
+  enc_ticks_seen = ticks;
+  return steps;
+}
+
+ISR(PCINT0_vect)
+{
+  uint8_t state = ENC_PINS();
+  enc_sub += enc_table[(enc_state << 2) | state];
+  enc_state = state;
+  if(enc_sub >= ENC_TRANSITIONS){
+    enc_ticks++;
+    enc_sub = 0;
+  }
+  else if(enc_sub <= -ENC_TRANSITIONS){
+    enc_ticks--;
+    enc_sub = 0;
+  }
+}
@@ -0,0 +1,211 @@
+#include "feedforward.h"
+#include "regulator.h"
+#include "mcp4725.h"
+#include "nvm.h"
+
+extern Mcp4725 dac;
+
+static uint16_t table[FF_POINTS];               //mA at each point
+static uint16_t slope[FF_POINTS - 1];           //DAC codes per mA of each segment, Q12
+static bool calibrated = false;
+
+static uint8_t status = FF_IDLE;
+static uint8_t point = 0;                       //being measured, then measured count
+static uint8_t measured = 0;
+static uint8_t skip = 0;
+static uint8_t count = 0;
+static long sum = 0;
+static uint8_t save_index = 0;
+static bool save_started = false;
+
+
+uint16_t ff_code(uint8_t point)
+{
+  uint16_t code = (uint16_t)point * 256;
+  return code > PID_DAC_MAX ? PID_DAC_MAX : code;
+}
+
+long ff_table(uint8_t point)
+{
+  return table[point];
+}
+
+bool ff_calibrated()
+{
+  return calibrated;
+}
+
+//Segment slopes, once per table so ff_dac() needs no division
+static void ff_slopes()
+{
+  for(uint8_t i = 0; i < FF_POINTS - 1; i++){
+    uint16_t di = table[i + 1] > table[i] ? table[i + 1] - table[i] : 1;
+    uint32_t s = ((uint32_t)(ff_code(i + 1) - ff_code(i)) << 12) / di;
+    slope[i] = s > 0xFFFF ? 0xFFFF : s;
+  }
+}
+
+static void ff_nominal()
+{
+  for(uint8_t i = 0; i < FF_POINTS; i++){
+    table[i] = ((uint32_t)ff_code(i) * 1250) >> 10;       //5000mA / 4096 codes
+  }
+  calibrated = false;
+  ff_slopes();
+}
+
+void ff_begin()
+{
+  uint8_t header[2];
+  nvm_read(FF_EEPROM_ADDR, header, 2);
+  if(header[0] != FF_MAGIC || header[1] < 2 || header[1] > FF_POINTS){
+    ff_nominal();
+    return;
+  }
+  uint8_t b[2];
+  for(uint8_t i = 0; i < FF_POINTS; i++){
+    nvm_read(FF_EEPROM_ADDR + 2 + 2 * i, b, 2);
+    table[i] = b[0] | (b[1] << 8);
+    if(i && table[i] <= table[i - 1]){            //must rise, or it can not be turned around
+      ff_nominal();
+      return;
+    }
+  }
+  calibrated = true;
+  ff_slopes();
+}
+
+int16_t ff_dac(long mA)
+{
+  if(mA <= (long)table[0]) return 0;
+  if(mA > 65535L) mA = 65535L;
+  uint8_t i = 0;
+  while(i < FF_POINTS - 2 && mA >= (long)table[i + 1]) i++;       //last segment also extrapolates
+  long code = ff_code(i) + (((uint32_t)(mA - table[i]) * slope[i] + 2048) >> 12);
+  return code > PID_DAC_MAX ? PID_DAC_MAX : code;
+}
+
+//A rate, not a level: the turn-on offset at the bottom of the table must not count
+int16_t ff_dac_step(long mA, long delta_mA)
+{
+  uint8_t i = 0;
+  while(i < FF_POINTS - 2 && mA > (long)table[i + 1]) i++;        //the segment that ends at mA
+  if(delta_mA > 65535L) delta_mA = 65535L;
+  long code = ((uint32_t)delta_mA * slope[i] + 2048) >> 12;
+  return code > PID_DAC_MAX ? PID_DAC_MAX : code;
+}
+
+void ff_clear()
+{
+  ff_nominal();
+  uint8_t erased = 0xFF;
+  nvm_write(FF_EEPROM_ADDR, &erased, 1);
+}
+
+
+/////////////////////////////Sweep//////////////////////////////////
+
+static void sweep_point(uint8_t p)
+{
+  point = p;
+  skip = FF_SETTLE_SAMPLES;
+  count = 0;
+  sum = 0;
+  dac.setVoltage(ff_code(p), false);
+}
+
+//Measured `n` points: fill in the rest and save, or give up
+static void sweep_end(uint8_t n)
+{
+  dac.setVoltage(0, false);
+  measured = n;
+  point = n;
+  if(n < 2 || table[n - 1] < table[0] + 100){
+    ff_begin();                                   //back to the old table
+    status = FF_FAIL;
+    return;
+  }
+  for(uint8_t i = n; i < FF_POINTS; i++){         //same slope as the last measured segment
+    long rise = (long)(table[n - 1] - table[n - 2]) * (ff_code(i) - ff_code(n - 1)) / (ff_code(n - 1) - ff_code(n - 2));
+    long mA = table[n - 1] + rise;
+    table[i] = mA > 65535L ? 65535U : mA;
+  }
+  calibrated = true;
+  ff_slopes();
+  save_index = 0;
+  save_started = false;
+  status = FF_SAVE;
+}
+
+void ff_sweep_start()
+{
+  status = FF_SWEEP;
+  sweep_point(0);
+}
+
+void ff_sweep_stop()
+{
+  if(status == FF_SWEEP){
+    dac.setVoltage(0, false);
+    ff_begin();
+    status = FF_IDLE;
+  }
+}
+
+void ff_sweep_sample(long mA, long mV)
+{
+  if(status != FF_SWEEP) return;
+  if(skip){
+    skip--;
+    return;
+  }
+  if(mV < FF_MIN_mV){                             //the supply gave up, this point does not count
+    sweep_end(point);
+    return;
+  }
+  sum += mA;
+  if(++count < FF_AVG_SAMPLES) return;
+  long average = sum / FF_AVG_SAMPLES;
+  if(average < 0) average = 0;
+  if(point >= 2 && average - table[point - 1] < ((long)table[point - 1] - table[point - 2]) / 2){
+    sweep_end(point);                             //hardly rose: the supply is at its current limit
+    return;
+  }
+  if(point && average <= (long)table[point - 1]) average = table[point - 1] + 1;
+  table[point] = average > 65535L ? 65535U : average;
+  if(point + 1 == FF_POINTS || average > MAX_SETPOINT_mA){
+    sweep_end(point + 1);
+    return;
+  }
+  sweep_point(point + 1);
+}
+
+void ff_poll()
+{
+  if(status != FF_SAVE) return;
+  if(!save_started){                              //invalid while the points change, a reset then means no table
+    uint8_t erased = 0xFF;
+    if(!nvm_write(FF_EEPROM_ADDR, &erased, 1)) return;
+    save_started = true;
+  }
+  while(save_index < FF_POINTS && nvm_free() >= 2){
+    uint8_t b[2] = {(uint8_t)table[save_index], (uint8_t)(table[save_index] >> 8)};
+    nvm_write(FF_EEPROM_ADDR + 2 + 2 * save_index, b, 2);
+    save_index++;
+  }
+  if(save_index == FF_POINTS && nvm_free() >= 2){
+    uint8_t header[2] = {FF_MAGIC, measured};
+    nvm_write(FF_EEPROM_ADDR, header, 2);         //valid again once every point is written
+    status = FF_DONE;
+  }
+}
+
+uint8_t ff_status()
+{
+  return status;
+}
+
+uint8_t ff_point()
+{
+  return point;
+}
@@ -0,0 +1,88 @@
+#include "filter.h"
+
+void filter_init(Filter &f, const FilterConfig &config)
+{
+  f.config = config;
+  if(f.config.median > FILTER_MEDIAN_MAX) f.config.median = FILTER_MEDIAN_MAX;
+  if(f.config.median < 1) f.config.median = 1;
+  if((1 << f.config.average_shift) > FILTER_AVERAGE_MAX) f.config.average_shift = 4;
+  f.window_pos = f.window_fill = 0;
+  f.history_pos = f.history_fill = 0;
+  f.sum = 0;
+}
+
+//Median of the window (of what is there while it fills up), insertion sort of at most 5 values
+static int32_t filter_median(const Filter &f)
+{
+  int32_t sorted[FILTER_MEDIAN_MAX];
+  uint8_t n = f.window_fill;
+  for(uint8_t i = 0; i < n; i++){
+    int32_t v = f.window[i];
+    uint8_t j = i;
+    for(; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+    sorted[j] = v;
+  }
+  return sorted[n / 2];
+}
+
+bool filter_push(Filter &f, int32_t raw, int32_t &out)
+{
+  int32_t x = raw;
+  if(f.config.median > 1){
+    f.window[f.window_pos] = raw;
+    f.window_pos = (f.window_pos + 1) % f.config.median;
+    if(f.window_fill < f.config.median) f.window_fill++;
+    x = filter_median(f);
+  }
+
+  uint8_t len = 1 << f.config.average_shift;
+  if(len == 1){
+    out = x;
+    return true;
+  }
+  if(f.config.decimate){
+    f.sum += x;
+    if(++f.history_fill < len) return false;
+    out = f.sum >> f.config.average_shift;
+    f.sum = 0;
+    f.history_fill = 0;
+    return true;
+  }
+  if(f.history_fill == len){
+    f.sum -= f.history[f.history_pos];
+  }
+  else{
+    f.history_fill++;
+  }
+  f.history[f.history_pos] = x;
+  f.history_pos = (f.history_pos + 1) % len;
+  f.sum += x;
+  out = f.history_fill == len ? f.sum >> f.config.average_shift : f.sum / f.history_fill;   //only divides while it fills up
+  return true;
+}
+
+uint8_t filter_lag(const FilterConfig &config)
+{
+  uint8_t lag = config.median / 2;
+  if(config.decimate){
+    return lag ? 2 : 1;                   //a block that straddles the step, then the first clean one
+  }
+  return lag + (1 << config.average_shift) / 2;
+}
+
+void smooth_reset(Smooth &s)
+{
+  s.primed = false;
+}
+
+long smooth_push(Smooth &s, long value)
+{
+  if(!s.primed){
+    s.value = value << SMOOTH_SHIFT;
+    s.primed = true;
+  }
+  else{
+    s.value += value - (s.value >> SMOOTH_SHIFT);
+  }
+  return s.value >> SMOOTH_SHIFT;
+}
@@ -0,0 +1,210 @@
+#include "i2c_bus.h"
+
+static I2cTransaction *volatile queue_head[2];
+static I2cTransaction *volatile queue_tail[2];
+static I2cTransaction *volatile current = 0;       //on the bus, 0 when the bus is idle
+#if PROFILE
+static unsigned long bus_start_us = 0;              //when current started, for PROF_BUS
+#endif
+
+
+//Highest priority transaction waiting, interrupts must be off
+static I2cTransaction *i2c_pop()
+{
+  for(uint8_t p = I2C_PRIO_HIGH; p <= I2C_PRIO_LOW; p++){
+    I2cTransaction *t = queue_head[p];
+    if(t){
+      queue_head[p] = t->next;
+      if(!queue_head[p]) queue_tail[p] = 0;
+      return t;
+    }
+  }
+  return 0;
+}
+
+static void i2c_start_next()
+{
+  current = i2c_pop();
+  if(current){
+    current->status = I2C_BUSY;
+#if PROFILE
+    bus_start_us = micros();
+#endif
+    i2c_hw_start(*current);
+  }
+}
+
+void i2c_begin(uint32_t clock_hz)
+{
+  for(uint8_t p = I2C_PRIO_HIGH; p <= I2C_PRIO_LOW; p++){    //starting over abandons anything still queued
+    for(I2cTransaction *t = queue_head[p]; t; t = t->next) t->status = I2C_IDLE;
+  }
+  if(current) current->status = I2C_IDLE;
+  queue_head[0] = queue_head[1] = 0;
+  queue_tail[0] = queue_tail[1] = 0;
+  current = 0;
+  i2c_hw_begin(clock_hz);
+}
+
+bool i2c_submit(I2cTransaction &t, uint8_t priority)
+{
+  uint8_t sreg = SREG;                  //also called from callbacks, so keep the interrupt state
+  cli();
+  if(t.status == I2C_QUEUED || t.status == I2C_BUSY){
+    SREG = sreg;
+    return false;
+  }
+  t.status = I2C_QUEUED;
+  t.next = 0;
+#if PROFILE
+  t.queued_us = micros();
+#endif
+  if(queue_tail[priority]){
+    queue_tail[priority]->next = &t;
+  }
+  else{
+    queue_head[priority] = &t;
+  }
+  queue_tail[priority] = &t;
+  if(!current){
+    i2c_start_next();
+  }
+  SREG = sreg;
+  return true;
+}
+
+bool i2c_pending(const I2cTransaction &t)
+{
+  uint8_t status = t.status;
+  return status == I2C_QUEUED || status == I2C_BUSY;
+}
+
+void i2c_wait(const I2cTransaction &t)
+{
+  while(i2c_pending(t)){
+    delayMicroseconds(10);
+  }
+}
+
+void i2c_wait_idle()
+{
+  while(current || queue_head[I2C_PRIO_HIGH] || queue_head[I2C_PRIO_LOW]){
+    delayMicroseconds(10);
+  }
+}
+
+//Called with interrupts off when the transaction on the bus is finished
+void i2c_hw_finished(bool ok)
+{
+  I2cTransaction *t = current;
+  current = 0;
+#if PROFILE
+  prof_end(PROF_BUS, bus_start_us);
+#endif
+  t->status = ok ? I2C_DONE : I2C_ERROR;
+  if(t->done){
+    t->done(*t);                        //may submit more work, which then starts the bus itself
+  }
+  if(!current){
+    i2c_start_next();
+  }
+}
+
+
+
+#ifdef __AVR__
+/////////////////////////////TWI hardware layer//////////////////////////////////
+#include <util/twi.h>
+
+static uint8_t twi_index = 0;           //next byte of tx or rx
+static bool twi_reading = false;        //in the read phase
+static bool twi_stop = false;           //a STOP is owed at the end of the interrupt
+
+static void twi_reply(bool ack)
+{
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | (ack ? _BV(TWEA) : 0);
+}
+
+static void twi_finish(bool ok)
+{
+  twi_stop = true;
+  i2c_hw_finished(ok);
+  if(twi_stop){                         //nothing else queued, release the bus
+    twi_stop = false;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  }
+}
+
+void i2c_hw_begin(uint32_t clock_hz)
+{
+  digitalWrite(SDA, HIGH);              //internal pullups, like Wire
+  digitalWrite(SCL, HIGH);
+  TWSR = 0;                             //prescaler 1
+  TWBR = ((F_CPU / clock_hz) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+void i2c_hw_start(I2cTransaction &t)
+{
+  (void)t;
+  if(twi_stop){                         //called from the end of the previous transaction: STOP then START
+    twi_stop = false;
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTO) | _BV(TWSTA);
+    return;
+  }
+  while(TWCR & _BV(TWSTO));             //the last STOP may still be on the bus (a few us)
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+}
+
+ISR(TWI_vect)
+{
+  I2cTransaction *t = current;
+  switch(TW_STATUS){
+    case TW_START:
+      twi_index = 0;
+      twi_reading = (t->tx_len == 0);
+      TWDR = (t->address << 1) | (twi_reading ? TW_READ : TW_WRITE);
+      twi_reply(false);
+      break;
+
+    case TW_REP_START:
+      twi_index = 0;
+      twi_reading = true;
+      TWDR = (t->address << 1) | TW_READ;
+      twi_reply(false);
+      break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if(twi_index < t->tx_len){
+        TWDR = t->tx[twi_index++];
+        twi_reply(false);
+      }
+      else if(t->rx_len){
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+      }
+      else{
+        twi_finish(true);
+      }
+      break;
+
+    case TW_MR_SLA_ACK:
+      twi_reply(t->rx_len > 1);         //NACK the last byte so the slave lets go of the bus
+      break;
+
+    case TW_MR_DATA_ACK:
+      t->rx[twi_index++] = TWDR;
+      twi_reply(twi_index < t->rx_len - 1);
+      break;
+
+    case TW_MR_DATA_NACK:
+      t->rx[twi_index++] = TWDR;
+      twi_finish(true);
+      break;
+
+    default:                            //address or data NACK, arbitration lost, bus error
+      twi_finish(false);
+      break;
+  }
+}
+#endif
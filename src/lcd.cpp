@@ -0,0 +1,179 @@
+#include "lcd.h"
+
+//PCF8574 to HD44780 wiring of the common backpacks
+#define LCD_RS          0x01
+#define LCD_EN          0x04
+#define LCD_BACKLIGHT   0x08
+
+#define LCD_CLEAR       0x01
+#define LCD_HOME        0x02
+#define LCD_ENTRY_LEFT  0x06
+#define LCD_DISPLAY_ON  0x0C
+#define LCD_FUNCTION_4BIT_2LINE  0x28
+#define LCD_SET_CGRAM   0x40
+#define LCD_SET_DDRAM   0x80
+
+Lcd::Lcd(uint8_t lcd_address, uint8_t cols, uint8_t lcd_rows)
+{
+  (void)cols;
+  address = lcd_address;
+  rows = lcd_rows;
+  backlight_bit = LCD_BACKLIGHT;
+  next_slot = 0;
+  custom = 0;
+  custom_count = 0;
+  init_step = 0xFF;
+}
+
+//Next transaction in round robin order, waiting for it if the LCD queue is full
+I2cTransaction &Lcd::slot()
+{
+  I2cTransaction &t = txn[next_slot];
+  next_slot = (next_slot + 1) % LCD_QUEUE_LEN;
+  i2c_wait(t);
+  t.address = address;
+  t.rx_len = 0;
+  t.done = 0;
+  return t;
+}
+
+uint8_t Lcd::freeSlots()
+{
+  return ready() ? queueFree() : 0;
+}
+
+uint8_t Lcd::queueFree()
+{
+  uint8_t n = 0;
+  for(uint8_t i = 0; i < LCD_QUEUE_LEN; i++){
+    if(!i2c_pending(txn[(next_slot + i) % LCD_QUEUE_LEN])) n++;
+    else break;                         //slots are reused in order, count only the ones ready in a row
+  }
+  return n;
+}
+
+void Lcd::send(uint8_t value, uint8_t mode)
+{
+  I2cTransaction &t = slot();
+  uint8_t high = (value & 0xF0) | mode | backlight_bit;
+  uint8_t low = ((value << 4) & 0xF0) | mode | backlight_bit;
+  t.tx_len = 6;
+  t.tx[0] = high;                       //the HD44780 latches the nibble on the falling edge of EN
+  t.tx[1] = high | LCD_EN;
+  t.tx[2] = high;
+  t.tx[3] = low;
+  t.tx[4] = low | LCD_EN;
+  t.tx[5] = low;
+  i2c_submit(t, I2C_PRIO_LOW);
+}
+
+void Lcd::sendNibble(uint8_t nibble)
+{
+  I2cTransaction &t = slot();
+  uint8_t bits = (nibble << 4) | backlight_bit;
+  t.tx_len = 3;
+  t.tx[0] = bits;
+  t.tx[1] = bits | LCD_EN;
+  t.tx[2] = bits;
+  i2c_submit(t, I2C_PRIO_LOW);
+}
+
+void Lcd::begin(const uint8_t (*chars)[8], uint8_t count)
+{
+  custom = chars;
+  custom_count = count;
+  init_step = 0;
+  init_start_us = micros();
+  init_wait_us = 50000;                 //HD44780 power up time, counted from reset
+}
+
+bool Lcd::ready()
+{
+  return init_step != 0xFF && init_step >= 8 + custom_count * 9;
+}
+
+//One step of the power up sequence when its wait is over and there is room, so it never waits itself. The
+//waits count from the step being queued, which is before it reaches the LCD, so they have some margin.
+void Lcd::poll()
+{
+  if(init_step == 0xFF || ready()) return;
+  if(micros() - init_start_us < init_wait_us || queueFree() == 0) return;
+  uint8_t step = init_step++;
+  init_start_us = micros();
+  init_wait_us = 0;
+  if(step < 3){                         //force 8 bit mode whatever state it was left in...
+    sendNibble(0x03);
+    init_wait_us = 4500;
+  }
+  else if(step == 3){                   //...then switch to 4 bit mode
+    sendNibble(0x02);
+    init_wait_us = 100;
+  }
+  else if(step == 4) send(LCD_FUNCTION_4BIT_2LINE, 0);
+  else if(step == 5) send(LCD_DISPLAY_ON, 0);
+  else if(step == 6) send(LCD_ENTRY_LEFT, 0);
+  else if(step == 7){
+    send(LCD_CLEAR, 0);
+    init_wait_us = 2500;                //1.52ms inside the HD44780
+  }
+  else{                                 //custom characters: address, then 8 rows each
+    uint8_t n = step - 8;
+    uint8_t row = n % 9;
+    if(row == 0) send(LCD_SET_CGRAM | ((n / 9 & 0x7) << 3), 0);
+    else send(custom[n / 9][row - 1], LCD_RS);
+  }
+}
+
+void Lcd::backlight()
+{
+  backlight_bit = LCD_BACKLIGHT;
+  I2cTransaction &t = slot();
+  t.tx_len = 1;
+  t.tx[0] = backlight_bit;
+  i2c_submit(t, I2C_PRIO_LOW);
+}
+
+void Lcd::noBacklight()
+{
+  backlight_bit = 0;
+  I2cTransaction &t = slot();
+  t.tx_len = 1;
+  t.tx[0] = 0;
+  i2c_submit(t, I2C_PRIO_LOW);
+}
+
+void Lcd::clear()
+{
+  send(LCD_CLEAR, 0);
+  i2c_wait_idle();
+  delayMicroseconds(2000);              //clear takes 1.52ms inside the HD44780
+}
+
+void Lcd::home()
+{
+  send(LCD_HOME, 0);
+  i2c_wait_idle();
+  delayMicroseconds(2000);
+}
+
+void Lcd::setCursor(uint8_t col, uint8_t row)
+{
+  static const uint8_t row_offsets[] = {0x00, 0x40, 0x14, 0x54};
+  if(row >= rows) row = rows - 1;
+  send(LCD_SET_DDRAM | (col + row_offsets[row]), 0);
+}
+
+void Lcd::createChar(uint8_t location, uint8_t charmap[])
+{
+  send(LCD_SET_CGRAM | ((location & 0x7) << 3), 0);
+  for(uint8_t i = 0; i < 8; i++){
+    write(charmap[i]);
+  }
+  i2c_wait_idle();
+}
+
+size_t Lcd::write(uint8_t value)
+{
+  send(value, LCD_RS);
+  return 1;
+}
@@ -1,33 +1,61 @@
-/////////////////////////////Library for i2c LCD//////////////////////////////////
-#include <Wire.h>
-#include <LiquidCrystal_I2C.h>      //Download it here: https://www.electronoobs.com/eng_arduino_liq_crystal.php
-LiquidCrystal_I2C lcd(0x27,16,2); //slave address sometimes can be 0x3f or 0x27. Try both!
-uint8_t arrow[8] = {0x0, 0x4 ,0x6, 0x3f, 0x6, 0x4, 0x0};
-uint8_t ohm[8] = {0xE ,0x11, 0x11, 0x11, 0xA, 0xA, 0x1B};
-uint8_t up[8] = {0x0 ,0x0, 0x4, 0xE , 0x1F, 0x4, 0x1C, 0x0};
-
-
-/////////////////////////////Library for ADS1115 ADC//////////////////////////////////
-#include <Adafruit_ADS1X15.h>       //Download here: https://www.electronoobs.com/eng_arduino_Adafruit_ADS1015.php
-Adafruit_ADS1X15 ads;         //Define i2c address 
-#define ADS1X15_CONVERSIONDELAY  (1)
-//#define ADS1015_CONVERSIONDELAY  (1)
-
-
-/////////////////////////////Library for MCP4725 DAC//////////////////////////////////
-#include <Adafruit_MCP4725.h>       //Download here: https://www.electronoobs.com/eng_arduino_Adafruit_MCP4725.php      
-//You need BusIO library as well    //install it with Arduino library manager if you don't have it
-Adafruit_MCP4725 dac;
-// Set this value to 9, 8, 7, 6 or 5 to adjust the resolution
-#define DAC_RESOLUTION    (9) //DAC resolution 12BIT: 0 to 4056
+/////////////////////////////i2c bus//////////////////////////////////
+#include "i2c_bus.h"                //LCD, ADC and DAC share the bus through an interrupt driven scheduler
+#ifdef I2C_FAST_MODE                //build flag, only with a PCA8574 LCD backpack (see README)
+#define I2C_CLOCK   400000      //fast mode: the ADS1115, the MCP4725 and the PCA8574 all support it
+#else
+#define I2C_CLOCK   100000      //standard mode, the PCF8574 on the LCD backpack is a 100kHz part
+#endif
+
+/////////////////////////////i2c LCD//////////////////////////////////
+#include "lcd.h"
+uint8_t lcd_address = 0x27;       //slave address sometimes can be 0x3f or 0x27. Try both! (SYST:LCD, kept in the EEPROM)
+Lcd lcd(0x27,16,2);                //setup() sets lcd_address before begin()
+#include "display.h"
+FrameBuffer display(lcd);         //The menus draw here, only changed characters are sent to the LCD
+const uint8_t lcd_chars[3][8] = {
+  {0x0, 0x4 ,0x6, 0x3f, 0x6, 0x4, 0x0},           //0: arrow
+  {0xE ,0x11, 0x11, 0x11, 0xA, 0xA, 0x1B},        //1: ohm
+  {0x0 ,0x0, 0x4, 0xE , 0x1F, 0x4, 0x1C, 0x0},    //2: up arrow
+};
+#define SPLASH_MS   2500          //The name stays on the LCD this long after reset, unless something is touched
+
+
+/////////////////////////////ADS1115 ADC//////////////////////////////////
+#include "ads1115.h"
+#include "acquisition.h"
+#include "regulator.h"
+#include "measure.h"
+#include "filter.h"
+Ads1115 ads;
+
+
+/////////////////////////////MCP4725 DAC//////////////////////////////////
+#include "mcp4725.h"
+Mcp4725 dac;
+uint8_t dac_address = 0x61;       //slave address sometimes can be 0x60, 0x61 or 0x62 (SYST:DAC, kept in the EEPROM)
 //////////////////////////////////////////////////////////////////////////////////////
 
 
 ///////////////////////////////////INPUTS/OUTPUTS/////////////////////////////////////
-int SW = 8;         //push button from encoder
-int SW_red = 11;    //(in my case) red push button for stop/resume
-int SW_blue = 12;   //(in my case) blue push button for menu
+const uint8_t SW = 8;         //push button from encoder
+const uint8_t SW_red = 11;    //(in my case) red push button for stop/resume
+const uint8_t SW_blue = 12;   //(in my case) blue push button for menu
 int Buzzer = 3;     //Buzzer connected on pin D3
+#include "menu.h"       //menu levels as a table driven state machine, debounced buttons
+#include "encoder.h"    //encoder CLK on D10, DT on D9
+#include "telemetry.h"  //binary frames on the serial port (TX), see telemetry.h for the format
+#include "scpi.h"       //remote control commands on the serial port (RX), see scpi.h
+#include "battery.h"    //battery discharge test: capacity counters and cutoff
+#include "dynamic.h"    //dynamic load: two levels switched by the 1ms timer interrupt
+#include "nvm.h"        //EEPROM writes in the background
+#include "sequence.h"   //list mode: stored CR/CC/CP steps timed by the 1ms timer interrupt
+#include "feedforward.h"  //DAC to current table, measured by a sweep
+#include "profile.h"      //loop, control and bus timing statistics, read with PROF commands
+#include "cv.h"           //constant voltage mode: target current from the voltage error
+#include "protect.h"      //OCP/OPP/UVP/OVP trips from the ADC interrupt, latched until acknowledged
+#include "thermal.h"      //heatsink NTC on A6, fan PWM on D6 and derating
+#include "sense.h"        //remote (4-wire) voltage sense on AIN2-AIN3, open lead check on A7
+#include "config.h"       //calibration, addresses, mode and setpoints saved in the EEPROM, restored at boot
 //////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -37,1103 +65,1043 @@ int Buzzer = 3;     //Buzzer connected on pin D3
 unsigned long Delay = 300;          //This is the LCD refresh rate. Each 300ms.
 unsigned long previousMillis = 0;   //Variables used for LCD refresh loop
 unsigned long currentMillis = 0;    //Variables used for LCD refresh loop
-int Rotary_counter = 0;             //Variable used to store the encoder position
+int Rotary_counter = 0;             //Variable used to store the encoder position (only the loop writes it)
 int Rotary_counter_prev = 0;        //Variable used to store the previous value of encoder
-bool clk_State;                     //State of the CLK pin from encoder (HIGH or LOW)
-bool Last_State;                    //Last state of CLK pin from encoder (HIGH or LOW)
-bool dt_State;                      //State of the DT pin from encoder (HIGH or LOW)
-int Menu_level = 1;                 //Menu is strucured by levels
+int Menu_level = 1;                 //Menu is strucured by levels, each one a state of the menu state machine (menu.h)
 int Menu_row = 1;                   //Each level could have different rows
-int push_count_ON = 0;              //Variable sued as counter to detect when a button is really pushed (debaunce)
-int push_count_OFF = 0;             //Variable sued as counter to detect when a button is NOT pushed (debaunce)
-String space_string = "______";     //used to print a line on LCD
-String space_string_mA = "____";    //used to print a line on LCD
-String pause_string = "";           //used to print something on LCD
-bool SW_STATUS = false;             //Store the status of the rotary encoder push button (pressed or not)
-bool SW_red_status = false;         //Store the status of the pause/resume button (pressed or not)
+MenuButton encoder_button = {SW, 0, false, false};
+MenuButton red_button = {SW_red, 0, false, false};
+MenuButton blue_button = {SW_blue, 0, false, false};
+bool encoder_pushed = false;        //The encoder button was pushed on this loop() pass
 bool pause = false;                 //store the status of pasue (enabeled or disabled)
+uint8_t trip_seen = 0;              //protection trips already handled by the loop
 
-//Variables for storing each decimal for current, resistance and power. 
-byte Ohms_0 = 0;
-byte Ohms_1 = 0;
-byte Ohms_2 = 0;
-byte Ohms_3 = 0;
-byte Ohms_4 = 0;
-byte Ohms_5 = 0;
-byte Ohms_6 = 0;
-byte mA_0 = 0;
-byte mA_1 = 0;
-byte mA_2 = 0;
-byte mA_3 = 0;
-byte mW_0 = 0;
-byte mW_1 = 0;
-byte mW_2 = 0;
-byte mW_3 = 0;
-byte mW_4 = 0;
+//Setpoint entry: each digit is set with the encoder, a push moves to the next one
+byte entry_digits[7];
 
 //Variables for ADC readings
-float ohm_setpoint = 0;
-float mA_setpoint = 0;
-float mW_setpoint = 0;
+long ohm_setpoint = 0;
+long mA_setpoint = 0;
+long mW_setpoint = 0;
+long mV_setpoint = 0;               //CV mode: input voltage to hold (mV)
+long batt_cutoff_mV = BATT_DEFAULT_CUTOFF;   //Battery test: stop below this voltage (the current is mA_setpoint)
+long dyn_level1_mA = 500;           //Dynamic load: current for the first duty% of each period
+long dyn_level2_mA = 100;           //Dynamic load: current for the rest of the period
+long dyn_freq_mHz = 10000;          //Dynamic load: switching frequency in mHz (10Hz)
+long dyn_duty = 50;                 //Dynamic load: % of the period at level 1
+long dyn_slew = 0;                  //Dynamic load: mA per ms between the levels, 0 = as fast as the DAC goes
+SeqStep edit_step;                  //List editor: the step on the LCD
+uint8_t edit_index = 0;             //List editor: its number (0 = first)
 int dac_value = 0;
+long voltage_on_load = 0;           //Last measured current (mA), kept between samples for the LCD
+long voltage_read = 0;              //Last measured input voltage (mV)
+long power_read = 0;                //Last measured power (mW)
+long current_uA = 0;                //The same current in uA, the fine ADC ranges resolve a few uA (acquisition.h)
+long display_mA = 0;                //The same through the display channel (filter.h), for the LCD
+long display_uA = 0;
+long display_mV = 0;
+long display_mW = 0;
+Filter current_filter, voltage_filter;    //Between the ADC and the regulator, chosen per mode
+Smooth smooth_mA, smooth_uA, smooth_mV, smooth_mW;
+int32_t filtered_current = 0;       //Last filter outputs (fine ADC counts, acquisition.h)
+int32_t filtered_voltage = 0;
+int filter_level = -1;              //Menu_level the filters are set up for
+
+//Filters for each mode (see filter.h): median length, average of 2^n samples, decimate. Modes not listed
+//get none. The regulated modes only reject spikes and average two samples: more lag would slow them down.
+//The battery test holds one current for hours and averages four; more would delay the cutoff. The dynamic
+//load needs samples right after an edge and the sweep averages by itself, they only reject spikes or nothing.
+struct ModeFilter {
+  uint8_t level;
+  FilterConfig config;
+};
+const ModeFilter mode_filters[] = {
+  {5,  {3, 1, false}},              //CR
+  {6,  {3, 1, false}},              //CC
+  {7,  {3, 1, false}},              //CP
+  {17, {3, 1, false}},              //CV
+  {9,  {3, 2, false}},              //Battery test
+  {14, {3, 1, false}},              //List
+  {15, {3, 0, false}},              //DAC sweep
+};
+Pid regulator;                      //Shared by the CR, CC and CP modes (see regulator.h)
 
 /////////////////////////////////////////////////////////////IMPORTANT//////////////////////////////////////////////////////////////////
 /*This part is important. You see, when you use the ADS1115, to pass from bit values (0 to 65000), we use a multiplier
   By default with GAIN_TWOTHIRDS that is "0.1875mV" or "0.0001875V". In the code, to measure current, we make a differential 
-  measurement of the voltage on the "0.1ohm" load. Since the load is 0.1ohm, current = voltage / 0.1 = voltage * 10. 
-  The base multiplier 0.0001875V needs to be multiplied by 10 to get current directly.
+  measurement of the voltage on the "1ohm" shunt. Since the shunt is 1ohm, current in mA = voltage in mV, so the
+  multiplier in mV per bit gives the current in mA directly. The multipliers are stored as integers scaled by 2^14
+  (0.1875 * 16384 = 3072) so no float math is needed, see measure.h.
   You might need to adjust this variable to other values till you get good readings, so while measuring the value with an 
   external multimeter at the same time, adjust this variable till you get good results. */
-const float multiplier = 0.1875;     //Multiplier used for "current" read between ADC0 and ADC1 of the ADS1115 with GAIN_TWOTHIRDS (0.0001875 * 10 for 0.1ohm resistor)    
+int32_t multiplier = 3072;          //Multiplier for "current" read between ADC0 and ADC1 with GAIN_TWOTHIRDS: 0.1875 mA per bit * 2^14 (1ohm shunt)
+const uint8_t multiplier_shift = 14;
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*The same goes here. But in this case, the voltage read is from a voltage divider. You see, the ADS1115 can only measure up to 6.144V 
   with GAIN_TWOTHIRDS. If the input is higher it will get damaged. So, for that between the ADS1115 and the main input I've used a 10K 
   and 100K divider and that will equal to a divider of 0.0909090. So, now the multiplier is 0.0001875 / 0.0909090 = 0.002063
   Now these resistor values are not perfect neither so we don't have exactly 10K and 100K, that's why my multiplier for voltage read
-  is 0.0020645. Just do the same, measure the voltage on the LCD screen and also with an external multimeter and adjust this value till you get 
+  is 0.0020645 (33825 once scaled by 2^14 to millivolts). Just do the same, measure the voltage on the LCD screen and also with an external multimeter and adjust this value till you get 
   good results. I've measured the resistors but that's not enough. We need precise values. */
-const float multiplier_A2 = 0.002063;   //Multiplier for voltage read from the 10K/100K divider with GAIN_TWOTHIRDS
+int32_t multiplier_A2 = 33800;      //Multiplier for voltage read from the 10K/100K divider with GAIN_TWOTHIRDS: 2.063 mV per bit * 2^14
+int32_t multiplier_sense = 33800;   //The same for AIN2-AIN3 with remote sense (sense.h), the two dividers in series with the leads
+const uint8_t multiplier_A2_shift = 14;
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//The values above are the defaults. CAL:CURR and CAL:VOLT (scpi.h) correct them against a meter without a rebuild, and
+//they are kept in the EEPROM with the other settings (config.h).
 
+//Voltage calibration in use: the AIN2 divider, or the AIN2-AIN3 difference with remote sense
+int32_t &voltage_multiplier(){
+  return sense_remote() ? multiplier_sense : multiplier_A2;
+}
 
+//New ADC calibrations (CAL:CURR / CAL:VOLT), the protection limits are raw counts worked out from them
+void set_calibration(int32_t current_num, int32_t voltage_num){
+  multiplier = current_num;
+  voltage_multiplier() = voltage_num;
+  protect_begin(multiplier, multiplier_shift, voltage_multiplier(), multiplier_A2_shift);
+}
 
+//Local or remote voltage sense (SENS:REM), the voltage limits follow the calibration of the input
+void set_remote_sense(bool remote){
+  sense_set_remote(remote);
+  set_calibration(multiplier, voltage_multiplier());
+}
 
+//Mode change from the serial port (scpi.cpp). Like finishing the setpoint entry in the menu, but the setpoints
+//and pause are left as the remote set them. Level 1 is the main menu with the DAC off.
+void remote_mode(int level){
+  menu_goto(Menu_level, level);
+  if(level == 15){
+    ff_sweep_start();               //From the menu it waits for a push
+  }
+}
 
-void setup() {
-  lcd.init();                 //Start i2c communication with the LCD
-  lcd.backlight();            //Activate backlight
-  
-  lcd.createChar(0, arrow);   //create the arrow character
-  lcd.createChar(1, ohm);     //create the ohm character
-  lcd.createChar(2, up);      //create the up arrow character
-  
-  lcd.clear();
-  lcd.setCursor(0,0);
-  lcd.print("  ELECTRONOOBS  "); 
-  tone(Buzzer, 500, 100);
-  delay(100);
-  tone(Buzzer, 700, 100);
-  delay(100);
-  tone(Buzzer, 1200, 100);
-  delay(300);
-  lcd.setCursor(0,1);
-  lcd.print("ELECTRONIC  LOAD");  
-  delay(2000);
-  
-  PCICR |= (1 << PCIE0);      //enable PCMSK0 scan                                                 
-  //PCMSK0 |= (1 << PCINT0);  //Set pin D8 trigger an interrupt on state change. 
-  PCMSK0 |= (1 << PCINT1);    //Pin 9 (DT) interrupt. Set pin D9 to trigger an interrupt on state change.
-  PCMSK0 |= (1 << PCINT2);    //Pin 10 (CLK) interrupt. Set pin D10 to trigger an interrupt on state change.
-  DDRB &= B11111001;          //Pins 8, 9, 10 as input  
-  pinMode(Buzzer,OUTPUT);     //Buzzer pin set as OUTPUT
-  digitalWrite(Buzzer, LOW);  //Buzzer turned OFF
-  pinMode(SW,INPUT_PULLUP);       //Encoder button set as input with pullup
-  pinMode(SW_blue,INPUT_PULLUP);  //Menu button set as input with pullup
-  pinMode(SW_red,INPUT_PULLUP);   //Stop/resume button set as input with pullup
-  delay(10);
+//Set up the filters for a mode, with empty histories
+void filter_select(int level){
+  FilterConfig config = {1, 0, false};
+  for(uint8_t i = 0; i < sizeof(mode_filters) / sizeof(mode_filters[0]); i++){
+    if(mode_filters[i].level == level) config = mode_filters[i].config;
+  }
+  filter_init(current_filter, config);
+  filter_init(voltage_filter, config);
+  pid_set_hold(regulator, PID_FF_HOLD + filter_lag(config));   //The samples the filters hold back come on top
+  smooth_reset(smooth_mA);
+  smooth_reset(smooth_uA);
+  smooth_reset(smooth_mV);
+  smooth_reset(smooth_mW);
+  filter_level = level;
+}
 
-  
-  ads.begin();      //Start i2c communication with the ADC
-  ads.setGain(GAIN_TWOTHIRDS);  // +/- 6.144V range (for differential measurements)
-  // Configure for differential mode between AIN0 and AIN1
-  // The readADC_Differential_0_1() function will use this configuration
-  delay(10);
-
-  dac.begin(0x61);  //Start i2c communication with the DAC (slave address sometimes can be 0x60, 0x61 or 0x62)
-  delay(10);
-  dac.setVoltage(0, false); //Set DAC voltage output to 0V (MOSFET turned off)
-  delay(10);
-   
-  previousMillis = millis();
+//Feed the last current/voltage pair to the filters, true when they give a new filtered pair
+bool filter_sample(){
+  AcqSample sample;
+  acq_latest(sample);
+  int32_t current, voltage;
+  bool ready = filter_push(current_filter, sample.current, current);
+  if(!filter_push(voltage_filter, sample.voltage, voltage) || !ready){
+    return false;
+  }
+  filtered_current = current;
+  filtered_voltage = voltage;
+  return true;
+}
 
+//Convert the last filtered current/voltage pair to mA, mV and mW (integer, see measure.h)
+void read_measurement(){
+  int32_t fine = filtered_current;                        //DIFFERENTIAL voltage between ADC0 and ADC1
+
+  // Check for reasonable ADC reading (not floating/disconnected)
+  if(abs(fine) > ACQ_OVERRANGE) {  // If reading is near max range, likely floating
+    voltage_on_load = 0;  // Set to 0 to prevent erratic behavior
+    current_uA = 0;
+  } else {
+    voltage_on_load = cal_apply_fine(fine, multiplier, multiplier_shift);
+    current_uA = (cal_apply_fine(fine, multiplier, multiplier_shift - 10) * 125 + 64) >> 7;   //mA in Q10 * 1000
+  }
+  voltage_read = cal_apply_fine(filtered_voltage, voltage_multiplier(), multiplier_A2_shift);
+  power_read = div1000(voltage_on_load * voltage_read);   //mA * mV = uW
+  display_mA = smooth_push(smooth_mA, voltage_on_load);
+  display_uA = smooth_push(smooth_uA, current_uA);
+  display_mV = smooth_push(smooth_mV, voltage_read);
+  display_mW = smooth_push(smooth_mW, power_read);
 }
 
-void loop() {
-  if(!digitalRead(SW_red) && !SW_red_status){
-    push_count_ON+=1;
-    if(push_count_ON > 10){  
-      tone(Buzzer, 1000, 300);          
-      pause = !pause;
-      SW_red_status = true;
-      push_count_ON=0;
-    }   
+//Target current of a CR (ohm), CC (mA) or CP (mW) setpoint at the last measured voltage, for those modes and
+//the list mode. The modes are their Menu_level.
+long target_current(uint8_t mode, long setpoint){
+  static Reciprocal per_ohm = {0, 0, 0};
+  if(mode == 5){
+    if(setpoint <= 0 || voltage_read <= 0) return 0;
+    if(per_ohm.divisor != (uint32_t)setpoint){            //only when the setpoint changes, no division per sample
+      recip_set(per_ohm, setpoint);
+    }
+    return recip_div(per_ohm, voltage_read);              //mV / ohm = mA
   }
-  if(digitalRead(SW_red) && SW_red_status){
-    SW_red_status = false;
-    push_count_ON = 0;
+  if(mode == 7){
+    if(voltage_read <= 50) return 0;
+    return (setpoint * 1000) / voltage_read;              //P = V*I, so the current that gives the power setpoint
   }
+  return setpoint;
+}
 
-  
-
-  
-  if(Menu_level == 1)
-  {
-    if(!digitalRead(SW) && !SW_STATUS)    {
-      
-      Rotary_counter = 0;
-      tone(Buzzer, 500, 20);
-      if(Menu_row == 1){
-        Menu_level = 2;
-        Menu_row = 1;
-      }
-      else if(Menu_row == 2){
-        Menu_level = 3;
-        Menu_row = 1;
-      }
-      else if(Menu_row == 3){
-        Menu_level = 4;
-        Menu_row = 1;
-      }
-      
-      SW_STATUS = true;
-    }
+//Target current clamped to the setpoint range and derated when the heatsink is hot (thermal.h)
+long limit_target(long mA){
+  return therm_limit(constrain(mA, 0L, (long)MAX_SETPOINT_mA));
+}
 
-    if(digitalRead(SW) && SW_STATUS)
-    {      
-      SW_STATUS = false;
-    }
+//Settings worth keeping across a power cycle (config.h). Only a mode that runs is kept, not a menu.
+bool run_level(int level){
+  return level == 5 || level == 6 || level == 7 || level == 17 || level == 9 || level == 11 || level == 14;
+}
 
+void config_collect(Config &c){
+  memset(&c, 0, sizeof(c));
+  c.current_num = multiplier;
+  c.voltage_num = multiplier_A2;
+  c.sense_num = multiplier_sense;
+  c.remote_sense = sense_remote();
+  c.ohm = ohm_setpoint;
+  c.mA = mA_setpoint;
+  c.mW = mW_setpoint;
+  c.mV = mV_setpoint;
+  c.batt_cutoff_mV = batt_cutoff_mV;
+  c.dyn_level1_mA = dyn_level1_mA;
+  c.dyn_level2_mA = dyn_level2_mA;
+  c.dyn_freq_mHz = dyn_freq_mHz;
+  c.dyn_duty = dyn_duty;
+  c.dyn_slew = dyn_slew;
+  c.ocp_mA = protect_limit(PROTECT_OCP);
+  c.opp_mW = protect_limit(PROTECT_OPP);
+  c.uvp_mV = protect_limit(PROTECT_UVP);
+  c.ovp_mV = protect_limit(PROTECT_OVP);
+  for(uint8_t r = 1; r < ACQ_RANGES; r++){
+    c.current_trim[r - 1] = acq_trim(ACQ_CURRENT, r);
+    c.voltage_trim[r - 1] = acq_trim(ACQ_VOLTAGE, r);
+  }
+  c.lcd_address = lcd_address;
+  c.dac_address = dac_address;
+  c.mode = run_level(Menu_level) ? Menu_level : 1;
+}
 
-    
-    
-    if(Rotary_counter < 0)
-    {
-      Rotary_counter = 0;
-    }
-    if(Rotary_counter > 12)
-    {
-      Rotary_counter = 12;
-    }
+//Everything but the mode, which is started once the hardware is up
+void config_apply(const Config &c){
+  multiplier = c.current_num;
+  multiplier_A2 = c.voltage_num;
+  multiplier_sense = c.sense_num;
+  sense_set_remote(c.remote_sense);
+  ohm_setpoint = c.ohm;
+  mA_setpoint = c.mA;
+  mW_setpoint = c.mW;
+  mV_setpoint = c.mV;
+  batt_cutoff_mV = c.batt_cutoff_mV;
+  dyn_level1_mA = c.dyn_level1_mA;
+  dyn_level2_mA = c.dyn_level2_mA;
+  dyn_freq_mHz = c.dyn_freq_mHz;
+  dyn_duty = c.dyn_duty;
+  dyn_slew = c.dyn_slew;
+  protect_set(PROTECT_OCP, c.ocp_mA);
+  protect_set(PROTECT_OPP, c.opp_mW);
+  protect_set(PROTECT_UVP, c.uvp_mV);
+  protect_set(PROTECT_OVP, c.ovp_mV);
+  for(uint8_t r = 1; r < ACQ_RANGES; r++){
+    acq_set_trim(ACQ_CURRENT, r, c.current_trim[r - 1]);
+    acq_set_trim(ACQ_VOLTAGE, r, c.voltage_trim[r - 1]);
+  }
+  lcd_address = c.lcd_address;
+  dac_address = c.dac_address;
+}
 
-    if (Rotary_counter <= 3)
-    {
-      Menu_row = 1;
-    }
-    else if (Rotary_counter > 3 && Rotary_counter <= 7)
-    {
-      Menu_row = 2;
-    }
-    else if (Rotary_counter > 7)
-    {
-      Menu_row = 3;
-    }
-    
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      if(Menu_row == 1)
-      {
-        lcd.clear();
-        lcd.setCursor(0,0);
-        lcd.write(0); 
-        lcd.print(" Cnt Load");
-        lcd.setCursor(0,1);
-        
-        lcd.print("  Cnt Current"); 
-      }
-    
-      else if(Menu_row == 2)
-      {
-        lcd.clear();
-        lcd.setCursor(0,0);     
-        lcd.print("  Cnt Load");
-        lcd.setCursor(0,1);
-        lcd.write(0);
-        lcd.print(" Cnt Current"); 
-      }
-    
-      else if(Menu_row == 3)
-      {
-        lcd.clear();
-        lcd.setCursor(0,0);  
-        lcd.write(0);   
-        lcd.print(" Cnt Power");    
-      }
-    }
+//List editor: load step `index`, or a default for a new one
+void edit_load(uint8_t index){
+  edit_index = index;
+  if(!seq_get(index, edit_step)){
+    edit_step.mode = SEQ_MODE_CC;
+    edit_step.setpoint = 100;
+    edit_step.dwell_ms = 1000;
+    edit_step.min_mV = 0;
+    edit_step.max_mA = 0;
   }
+}
 
 
-  if(Menu_level == 2)
-  {
-    if(Rotary_counter < 0)
-    {
-      Rotary_counter = 0;
-    }
-    if(Rotary_counter > 9)
-    {
-      Rotary_counter = 9;
-    }
-    if(!digitalRead(SW) && !SW_STATUS)
-    {
-      tone(Buzzer, 500, 20);
-      push_count_ON = push_count_ON + 1;
-      push_count_OFF = 0;
-      if(push_count_ON > 20)
-      {
-        Menu_row = Menu_row + 1;
-        if(Menu_row > 7)
-        {
-          Menu_level = 5;
-          pause = false;
-          ohm_setpoint = Ohms_0*1000000 + Ohms_1*100000 + Ohms_2*10000 + Ohms_3*1000 + Ohms_4*100 + Ohms_5*10 + Ohms_6; 
-          
-        }
-        Rotary_counter = 0;
-        SW_STATUS = true;
-        space_string = space_string + "_";
-        push_count_ON = 0;
-      }      
-    }
 
-    if(digitalRead(SW) && SW_STATUS)
-    {      
-      push_count_ON = 0; 
-      push_count_OFF = push_count_OFF + 1; 
-      if(push_count_OFF > 20){
-        SW_STATUS = false;
-        push_count_OFF = 0;
-      }
-        
-    }
-    
 
-    if(Menu_row == 1)
-    {
-      Ohms_0 = Rotary_counter;      
-    }
-    if(Menu_row == 2)
-    {
-      Ohms_1 = Rotary_counter;      
-    }
-    if(Menu_row == 3)
-    {
-      Ohms_2 = Rotary_counter;
-    }
-    if(Menu_row == 4)
-    {
-      Ohms_3 = Rotary_counter;     
-    }
-    if(Menu_row == 5)
-    {
-      Ohms_4 = Rotary_counter;      
-    }
-    if(Menu_row == 6)
-    {
-      Ohms_5 = Rotary_counter;      
-    }
-    if(Menu_row == 7)
-    {
-      Ohms_6 = Rotary_counter;      
-    }
-    
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print("Ohms: ");
-      lcd.print(Ohms_0);
-      lcd.print(Ohms_1);
-      lcd.print(Ohms_2);
-      lcd.print(Ohms_3);
-      lcd.print(Ohms_4);
-      lcd.print(Ohms_5);
-      lcd.print(Ohms_6);
-      lcd.setCursor(0,1);    
-      lcd.print(space_string);
-      lcd.write(2);
-    }
 
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string = "______";    
-      ohm_setpoint = 0;  
-      Ohms_1 = 0;
-      Ohms_2 = 0;
-      Ohms_3 = 0;
-      Ohms_4 = 0;
-      Ohms_5 = 0;
-      Ohms_6 = 0;
-    }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string = "______";    
-      ohm_setpoint = 0;  
-      Ohms_1 = 0;
-      Ohms_2 = 0;
-      Ohms_3 = 0;
-      Ohms_4 = 0;
-      Ohms_5 = 0;
-      Ohms_6 = 0;
-    }
+/////////////////////////////Menu states//////////////////////////////////
+/*One set of handlers per Menu_level, dispatched from the tables at the end of this block (see menu.h).
+  loop() reads the buttons, follows the blue button back, then calls input on every pass, regulate on every
+  new sample and draw every Delay with the frame already cleared. */
+
+//Every state change: first row, encoder from 0, PID from 0 (every mode starts with the MOSFET off), redraw now
+void menu_change(){
+  Menu_row = 1;
+  Rotary_counter = 0;
+  Rotary_counter_prev = 0;
+  pid_bumpless(regulator, 0);
+  previousMillis = millis() - Delay;
+}
+
+//Pages that do not regulate
+void menu_enter(){
+  dac.setVoltage(0, false);
+}
+
+//Print a string from the flash (PROGMEM tables, protect_name())
+void print_P(const char *text){
+  char c;
+  while((c = pgm_read_byte(text++))) display.write(c);
+}
+
+//Measured current for the LCD: under 10mA in 10uA steps from the fine ADC ranges, whole mA above. It takes
+//no more room than the mA did, the full uA are on MEAS:CURR?.
+void print_current(){
+  if(display_uA >= 5 && display_uA < 10000) display.print(display_uA / 1000.0, 2);
+  else display.print(display_uA < 5 ? 0 : display_mA);
+  display.print(F("mA"));
+}
+
+//Encoder steps since the last pass, 0 when none
+int encoder_steps(){
+  int step = Rotary_counter - Rotary_counter_prev;
+  Rotary_counter_prev = Rotary_counter;
+  return step;
+}
+
+//Run modes: the encoder trims the setpoint by `unit` per step, never below 0
+void adjust_setpoint(long &setpoint, long unit){
+  int step = encoder_steps();
+  if(step){
+    setpoint += step * unit;
+    if(setpoint < 0) setpoint = 0;
   }
+}
 
+//The regulated modes once they know their target current
+void regulate_current(long mA){
+  if(!pause){
+    long target = limit_target(mA);
+    pid_feed_forward(regulator, ff_dac(target));   //Straight to the calibrated DAC value, the PID trims the rest
+    dac_value = pid_update(regulator, target, voltage_on_load);
+    dac.setVoltage(dac_value, false);
+  }
+  else{
+    pid_bumpless(regulator, dac_value);        //Hold the output so resume continues from the same DAC value
+    dac.setVoltage(0, false);
+  }
+}
 
+//Bottom line of the regulated modes: measured current and power, and PAUSE
+void draw_measured(bool power_first){
+  display.setCursor(0,1);
+  if(power_first){
+    display.print(display_mW);  display.print(F("mW")); display.print(' '); print_current();
+  }
+  else{
+    print_current(); display.print(' '); display.print(display_mW);  display.print(F("mW"));
+  }
+  if(pause) display.print(F(" PAUSE"));
+}
 
 
 
+//Main menu: the encoder moves the arrow (4 steps per row), a push opens the row
+const char menu_names[8][12] PROGMEM = {
+  "Cnt Load", "Cnt Current", "Cnt Power", "Cnt Voltage", "Battery", "Dynamic", "List", "Calibrate"
+};
+const uint8_t menu_top[8] PROGMEM = {1, 1, 3, 3, 4, 5, 6, 7};   //row shown on the top line for each Menu_row
 
+void main_input(){
+  Rotary_counter = constrain(Rotary_counter, 0, 31);
+  Menu_row = Rotary_counter / 4 + 1;
+  if(encoder_pushed){
+    tone(Buzzer, 500, 20);
+    menu_event(Menu_level, MENU_PICK + Menu_row);
+  }
+}
 
-  if(Menu_level == 3)
-  {
-    if(Rotary_counter < 0)
-    {
-      Rotary_counter = 0;
-    }
-    if(Rotary_counter > 9)
-    {
-      Rotary_counter = 9;
-    }
-    
-    if(!digitalRead(SW) && !SW_STATUS)
-    {
-      tone(Buzzer, 500, 20);
-      push_count_ON = push_count_ON + 1;
-      push_count_OFF = 0;
-      if(push_count_ON > 20)
-      {
-        Menu_row = Menu_row + 1;
-        if(Menu_row > 4)
-        {
-          Menu_level = 6;
-          pause = false;
-          mA_setpoint = mA_0*1000 + mA_1*100 + mA_2*10 + mA_3; 
-          
-        }
-        Rotary_counter = 0;
-        SW_STATUS = true;
-        space_string_mA = space_string_mA + "_";
-        push_count_ON = 0;
-      }      
-    }
+void main_draw(){
+  uint8_t top = pgm_read_byte(&menu_top[Menu_row - 1]);
+  for(uint8_t line = 0; line < 2; line++){
+    display.setCursor(0, line);
+    if(top + line == Menu_row) display.write(0); else display.print(' ');
+    display.print(' ');
+    print_P(menu_names[top + line - 1]);
+  }
+}
 
-    if(digitalRead(SW) && SW_STATUS)
-    {      
-      push_count_ON = 0; 
-      push_count_OFF = push_count_OFF + 1; 
-      if(push_count_OFF > 20){
-        SW_STATUS = false;
-        push_count_OFF = 0;
-      }
-        
-    }
-    
 
-    if(Menu_row == 1)
-    {
-      mA_0 = Rotary_counter;      
-    }
-    if(Menu_row == 2)
-    {
-      mA_1 = Rotary_counter;      
-    }
-    if(Menu_row == 3)
-    {
-      mA_2 = Rotary_counter;
-    }
-    if(Menu_row == 4)
-    {
-      mA_3 = Rotary_counter;     
-    }
-    
-    
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print("mA: ");
-      lcd.print(mA_0);
-      lcd.print(mA_1);
-      lcd.print(mA_2);
-      lcd.print(mA_3);     
-      lcd.setCursor(0,1);    
-      lcd.print(space_string_mA);
-      lcd.write(2);
+
+//Setpoint entry for CR, CC, CP and CV: one digit per push, the last push starts the mode with the number
+struct DigitEntry {
+  uint8_t level;
+  char label[7];
+  uint8_t digits;
+  long *setpoint;
+};
+const DigitEntry digit_entries[] PROGMEM = {
+  {2,  "Ohms: ", 7, &ohm_setpoint},
+  {3,  "mA: ",   4, &mA_setpoint},
+  {4,  "mW: ",   5, &mW_setpoint},
+  {16, "mV: ",   5, &mV_setpoint},
+};
+DigitEntry entry;                   //The one on the LCD
+
+void entry_enter(){
+  menu_enter();
+  for(uint8_t i = 0; i < sizeof(digit_entries) / sizeof(digit_entries[0]); i++){
+    if(pgm_read_byte(&digit_entries[i].level) == Menu_level) memcpy_P(&entry, &digit_entries[i], sizeof(entry));
+  }
+  memset(entry_digits, 0, sizeof(entry_digits));
+}
+
+void entry_input(){
+  if(encoder_pushed){
+    tone(Buzzer, 500, 20);
+    Menu_row = Menu_row + 1;
+    Rotary_counter = 0;
+    if(Menu_row > entry.digits){
+      long value = 0;
+      for(uint8_t i = 0; i < entry.digits; i++) value = value * 10 + entry_digits[i];
+      *entry.setpoint = value;
+      pause = false;
+      menu_event(Menu_level, MENU_DONE);
+      return;
     }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string_mA = "____";  
-      mA_setpoint = 0;   
-      mA_0 = 0;
-      mA_1 = 0;
-      mA_2 = 0;      
-    }     
   }
+  Rotary_counter = constrain(Rotary_counter, 0, 9);
+  entry_digits[Menu_row - 1] = Rotary_counter;
+}
 
+void entry_draw(){
+  display.print(entry.label);
+  for(uint8_t i = 0; i < entry.digits; i++) display.print(entry_digits[i]);
+  display.setCursor(0,1);
+  for(uint8_t i = strlen(entry.label) + Menu_row - 1; i > 0; i--) display.print('_');
+  display.write(2);
+}
 
 
 
+//Constant Load Mode
+void cr_input(){
+  adjust_setpoint(ohm_setpoint, 1);
+}
 
+void cr_regulate(){
+  regulate_current(target_current(Menu_level, ohm_setpoint));
+}
 
+void cr_draw(){
+  display.print(ohm_setpoint); display.write(1); display.print(' '); display.print(display_mV / 1000.0, 3); display.print('V');
+  draw_measured(false);
+}
 
 
 
+//Constant Current Mode
+void cc_input(){
+  adjust_setpoint(mA_setpoint, 1);
+}
 
-  
+void cc_regulate(){
+  regulate_current(mA_setpoint);
+}
 
-  if(Menu_level == 4)
-  {
-    if(Rotary_counter < 0)
-    {
-      Rotary_counter = 0;
-    }
-    if(Rotary_counter > 9)
-    {
-      Rotary_counter = 9;
-    }
-    
-    if(!digitalRead(SW) && !SW_STATUS)
-    {
-      tone(Buzzer, 500, 20);
-      push_count_ON = push_count_ON + 1;
-      push_count_OFF = 0;
-      if(push_count_ON > 20)
-      {
-        Menu_row = Menu_row + 1;
-        if(Menu_row > 5)
-        {
-          Menu_level = 7;
-          pause = false;
-          mW_setpoint = mW_0*10000 + mW_1*1000 + mW_2*100 + mW_3*10 + mW_4; 
-          
-        }
-        Rotary_counter = 0;
-        SW_STATUS = true;
-        space_string_mA = space_string_mA + "_";
-        push_count_ON = 0;
-      }      
-    }
+void cc_draw(){
+  display.print(mA_setpoint); display.print(F("mA ")); display.print(display_mV / 1000.0); display.print('V');
+  draw_measured(false);
+}
 
-    if(digitalRead(SW) && SW_STATUS)
-    {      
-      push_count_ON = 0; 
-      push_count_OFF = push_count_OFF + 1; 
-      if(push_count_OFF > 20){
-        SW_STATUS = false;
-        push_count_OFF = 0;
-      }
-        
-    }
-    
 
-    if(Menu_row == 1)
-    {
-      mW_0 = Rotary_counter;      
-    }
-    if(Menu_row == 2)
-    {
-      mW_1 = Rotary_counter;      
-    }
-    if(Menu_row == 3)
-    {
-      mW_2 = Rotary_counter;
-    }
-    if(Menu_row == 4)
-    {
-      mW_3 = Rotary_counter;
-    }
-    if(Menu_row == 5)
-    {
-      mW_4 = Rotary_counter;
-    }
-    
-    
-    
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print("mW: ");
-      lcd.print(mW_0);
-      lcd.print(mW_1);
-      lcd.print(mW_2);
-      lcd.print(mW_3); 
-      lcd.print(mW_4);            
-      lcd.setCursor(0,1);    
-      lcd.print(space_string_mA);
-      lcd.write(2);
-    }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string_mA = "____";
-      mW_setpoint = 0;
-      mW_0 = 0;
-      mW_1 = 0;
-      mW_2 = 0;  
-      mW_3 = 0; 
-      mW_4 = 0;     
-    }
-  }
 
+//Constant Power Mode
+void cp_input(){
+  adjust_setpoint(mW_setpoint, 1);
+}
 
+void cp_regulate(){
+  regulate_current(target_current(Menu_level, mW_setpoint));
+}
 
+void cp_draw(){
+  display.print(mW_setpoint); display.print(F("mW ")); display.print(display_mV / 1000.0); display.print('V');
+  draw_measured(true);
+}
 
 
-  //Constant Load Mode
-  if(Menu_level == 5)
-  {
-    if(Rotary_counter > Rotary_counter_prev)
-    {
-      ohm_setpoint = ohm_setpoint + 1;
-      Rotary_counter_prev = Rotary_counter;
-      
-    }
 
-    if(Rotary_counter < Rotary_counter_prev)
-    {
-      ohm_setpoint = ohm_setpoint - 1;
-      Rotary_counter_prev = Rotary_counter;
-      
-    }
-    
-    float voltage_on_load, voltage_read, power_read;  
-    int16_t raw_adc = ads.readADC_Differential_0_1();      //Read DIFFERENTIAL voltage between ADC0 and ADC1
-    
-    // Check for reasonable ADC reading (not floating/disconnected)
-    if(abs(raw_adc) > 32000) {  // If reading is near max range, likely floating
-      voltage_on_load = 0;  // Set to 0 to prevent erratic behavior
-    } else {
-      voltage_on_load = (raw_adc * multiplier)*1000;
-    }
+//Constant Voltage Mode: sink whatever current holds the input at mV_setpoint (chargers, solar panels)
+void cv_enter(){
+  cv_start(0);
+}
 
-    voltage_read = ads.readADC_SingleEnded(2);
-    voltage_read = (voltage_read * multiplier_A2);
-    
-    //sensosed_voltage = ads.readADC_SingleEnded(3);
-    //sensosed_voltage = (sensosed_voltage * multiplier);
-    
-    power_read = voltage_on_load * voltage_read;
-
-    float setpoint_current = (voltage_read / ohm_setpoint) * 1000;
-
-    float error = abs(setpoint_current - voltage_on_load);
-    
-    if (error > (setpoint_current*0.8))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 300;
-      }
-
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 300;
-      }
-    }
+void cv_input(){
+  adjust_setpoint(mV_setpoint, 10);
+  if(mV_setpoint > MAX_SETPOINT_mV) mV_setpoint = MAX_SETPOINT_mV;     //also what the digit entry allows
+}
 
-    else if (error > (setpoint_current*0.6))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 170;
-      }
+void cv_regulate(){
+  regulate_current(pause ? 0 : cv_update(mV_setpoint, voltage_read, voltage_on_load));   //Current that holds the voltage (cv.h)
+}
 
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 170;
-      }
-    }
+void cv_draw(){
+  display.print(mV_setpoint); display.print(F("mV ")); display.print(display_mV / 1000.0, 3); display.print('V');
+  draw_measured(false);
+}
 
-    else if (error > (setpoint_current*0.4))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 120;
-      }
 
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 120;
-      }
-    }
-    else if (error > (setpoint_current*0.3))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 60;
-      }
-
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 60;
-      }
-    }
-    else if (error > (setpoint_current*0.2))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 40;
-      }
-
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 40;
-      }
+
+//Battery test setup: the encoder sets the cutoff voltage (10mV steps), push, then the discharge current (10mA steps), push to start
+void batt_setup_input(){
+  int step = encoder_steps();
+  if(Menu_row == 1){
+    batt_cutoff_mV = constrain(batt_cutoff_mV + step * 10L, 0L, 60000L);
+  }
+  else{
+    mA_setpoint = constrain(mA_setpoint + step * 10L, 0L, (long)MAX_SETPOINT_mA);
+  }
+  if(encoder_pushed){
+    tone(Buzzer, 500, 20);
+    if(Menu_row == 1){
+      Menu_row = 2;
     }
-    else if (error > (setpoint_current*0.1))
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 30;
-      }
-
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 30;
-      }
+    else{
+      pause = false;
+      menu_event(Menu_level, MENU_DONE);
     }
-    else
-    {
-      if(setpoint_current > voltage_on_load){
-        dac_value = dac_value + 1;
-      }
-
-      if(setpoint_current < voltage_on_load){
-        dac_value = dac_value - 1;
-      }
+  }
+}
+
+void batt_setup_draw(){
+  if(Menu_row == 1) display.write(0); else display.print(' ');
+  display.print(F("Cutoff "));  display.print(batt_cutoff_mV / 1000.0); display.print('V');
+  display.setCursor(0,1);
+  if(Menu_row == 2) display.write(0); else display.print(' ');
+  display.print(F("Load "));  display.print(mA_setpoint); display.print(F("mA"));
+}
+
+
+
+//Battery test: constant current, charge and energy counted on every sample, load off at the cutoff
+void batt_enter(){
+  batt_start();
+}
+
+void batt_regulate(){
+  AcqSample sample;
+  acq_latest(sample);
+
+  if(!batt_sample(sample.stamp_us, voltage_on_load, voltage_read, batt_cutoff_mV, !pause)){
+    pause = true;                 //Cutoff: the load goes off in this same step
+  }
+  if(!pause && batt_ended() && !batt_can_resume(voltage_read, batt_cutoff_mV)){
+    pause = true;                 //Resume refused until the battery has recovered (hysteresis)
+  }
+  regulate_current(mA_setpoint);
+}
+
+void batt_draw(){
+  display.print(display_mV / 1000.0); display.print(F("V ")); print_current();
+  if(batt_ended()) display.print(F(" END"));
+  else if(pause) display.print(F(" OFF"));
+  display.setCursor(0,1);
+  display.print(batt_uAh() / 1000); display.print(F("mAh ")); display.print(batt_uWh() / 1000); display.print(F("mWh"));
+}
+
+
+
+//Dynamic load setup: the encoder sets level 1, level 2 (10mA steps), frequency (Hz), duty (%) and slew
+//(10mA/ms steps, 0 = step at once), a push moves to the next one and the last push starts the load
+void dyn_setup_input(){
+  int step = encoder_steps();
+  if(step){
+    if(Menu_row == 1){
+      dyn_level1_mA = constrain(dyn_level1_mA + step * 10L, 0L, (long)MAX_SETPOINT_mA);
     }
-    
-    
-    
-    if(dac_value > 4095)
-    {
-      dac_value = 4095;
+    else if(Menu_row == 2){
+      dyn_level2_mA = constrain(dyn_level2_mA + step * 10L, 0L, (long)MAX_SETPOINT_mA);
     }
-    if(dac_value < 0)
-    {
-      dac_value = 0;
+    else if(Menu_row == 3){
+      dyn_freq_mHz = constrain((dyn_freq_mHz / 1000 + step) * 1000L, 1000L, 100000L);
     }
-    
-  
-    
-    if(!pause){
-      dac.setVoltage(dac_value, false);
-      pause_string = "";
+    else if(Menu_row == 4){
+      dyn_duty = constrain(dyn_duty + step, 1L, 99L);
     }
     else{
-      dac.setVoltage(0, false);
-      pause_string = " PAUSE";
+      dyn_slew = constrain(dyn_slew + step * 10L, 0L, (long)MAX_SETPOINT_mA);
     }
-    
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print(ohm_setpoint,0); lcd.write(1); lcd.print(" "); lcd.print(voltage_read,3); lcd.print("V");
-      lcd.setCursor(0,1);    
-      lcd.print(voltage_on_load,0);  lcd.print("mA"); lcd.print(" "); lcd.print(power_read,0);  lcd.print("mW"); 
-      lcd.print(pause_string);
+  }
+  if(encoder_pushed){
+    tone(Buzzer, 500, 20);
+    if(Menu_row < 5){
+      Menu_row++;
     }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string = "______";    
-      ohm_setpoint = 0;  
-      Ohms_1 = 0;
-      Ohms_2 = 0;
-      Ohms_3 = 0;
-      Ohms_4 = 0;
-      Ohms_5 = 0;
-      Ohms_6 = 0;
+    else{
+      pause = false;
+      menu_event(Menu_level, MENU_DONE);
     }
   }
+}
 
+void dyn_setup_draw(){
+  if(Menu_row <= 2){
+    display.print(Menu_row == 1 ? '>' : ' ');
+    display.print(F("Level1 ")); display.print(dyn_level1_mA); display.print(F("mA"));
+    display.setCursor(0,1);
+    display.print(Menu_row == 2 ? '>' : ' ');
+    display.print(F("Level2 ")); display.print(dyn_level2_mA); display.print(F("mA"));
+  }
+  else if(Menu_row <= 4){
+    display.print(Menu_row == 3 ? '>' : ' ');
+    display.print(F("Freq ")); display.print(dyn_freq_mHz / 1000); display.print(F("Hz"));
+    display.setCursor(0,1);
+    display.print(Menu_row == 4 ? '>' : ' ');
+    display.print(F("Duty ")); display.print(dyn_duty); display.print('%');
+  }
+  else{
+    display.print(F(">Slew "));
+    if(dyn_slew) { display.print(dyn_slew); display.print(F("mA/ms")); }
+    else display.print(F("max"));
+    display.setCursor(0,1);
+    display.print(F(" push to start"));
+  }
+}
 
 
 
+//Dynamic load: the timer interrupt makes the edges, here the two levels are only trimmed from the samples
+void dyn_enter(){
+  dyn_start();
+}
 
+void dyn_exit(){
+  dyn_stop();
+}
 
+void dyn_input(){
+  dyn_configure(limit_target(dyn_level1_mA), limit_target(dyn_level2_mA), dyn_freq_mHz, dyn_duty, dyn_slew, !pause);
+}
 
+void dyn_regulate(){
+  dyn_trim(voltage_on_load);
+}
 
-  //Constant Current Mode
-  if(Menu_level == 6)
-  {
-    if(Rotary_counter > Rotary_counter_prev)
-    {
-      mA_setpoint = mA_setpoint + 1;
-      Rotary_counter_prev = Rotary_counter;
-    }
+void dyn_draw(){
+  display.print(dyn_level1_mA); display.print('/'); display.print(dyn_level2_mA); display.print(F("mA"));
+  if(pause) display.print(F(" OFF"));
+  display.setCursor(0,1);
+  display.print(dyn_freq_mHz / 1000.0, 1); display.print(F("Hz ")); display.print(dyn_duty); display.print(F("% "));
+  display.print(display_mV / 1000.0, 1); display.print('V');
+}
 
-    if(Rotary_counter < Rotary_counter_prev)
-    {
-      mA_setpoint = mA_setpoint - 1;
-      Rotary_counter_prev = Rotary_counter;
-    }
-    
-    float voltage_on_load, voltage_read, power_read;
-      
-    int16_t raw_adc = ads.readADC_Differential_0_1();      //Read DIFFERENTIAL voltage between ADC0 and ADC1
-    
-    // Check for reasonable ADC reading (not floating/disconnected)
-    if(abs(raw_adc) > 32000) {  // If reading is near max range, likely floating
-      voltage_on_load = 0;  // Set to 0 to prevent erratic behavior
-    } else {
-      voltage_on_load = (raw_adc * multiplier)*1000;
-    }
 
-    voltage_read = ads.readADC_SingleEnded(2);
-    voltage_read = (voltage_read * multiplier_A2);
-    
-    //sensosed_voltage = ads.readADC_SingleEnded(3);
-    //sensosed_voltage = (sensosed_voltage * multiplier);
-    
-    power_read = voltage_on_load * voltage_read;
-
-    float error = abs(mA_setpoint - voltage_on_load);
-    
-    if (error > (mA_setpoint*0.8))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 300;
-      }
-
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 300;
-      }
-    }
 
-    else if (error > (mA_setpoint*0.6))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 170;
-      }
+//List mode page: run the stored list or edit it
+void list_input(){
+  Rotary_counter = constrain(Rotary_counter, 0, 1);
+  Menu_row = Rotary_counter + 1;
+  if(!encoder_pushed) return;
+  if(Menu_row == 2){
+    tone(Buzzer, 500, 20);
+    menu_event(Menu_level, MENU_EDIT);
+  }
+  else if(seq_count()){
+    tone(Buzzer, 500, 20);
+    pause = false;
+    menu_event(Menu_level, MENU_DONE);
+  }
+  else{
+    tone(Buzzer, 200, 200);       //Nothing stored yet
+  }
+}
 
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 170;
-      }
-    }
+void list_draw(){
+  if(Menu_row == 1) display.write(0); else display.print(' ');
+  display.print(F(" Run ")); display.print(seq_count()); display.print(F(" steps"));
+  display.setCursor(0,1);
+  if(Menu_row == 2) display.write(0); else display.print(' ');
+  display.print(F(" Edit"));
+}
 
-    else if (error > (mA_setpoint*0.4))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 120;
-      }
 
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 120;
-      }
-    }
-    else if (error > (mA_setpoint*0.3))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 60;
-      }
-
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 60;
-      }
-    }
 
-    else if (error > (mA_setpoint*0.2))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 40;
-      }
+//List editor: the encoder sets the mode (CR, CC, CP or End), the setpoint (1ohm, 10mA or 100mW steps) and
+//the time (100ms steps) of each step, a push moves to the next. End cuts the list there.
+void list_edit_enter(){
+  menu_enter();
+  edit_load(0);
+}
 
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 40;
-      }
-    }
-    
-    else if (error > (mA_setpoint*0.1))
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 30;
-      }
-
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 30;
-      }
+void list_edit_input(){
+  int step = encoder_steps();
+  if(step){
+    long unit = edit_step.mode == SEQ_MODE_CR ? 1 : edit_step.mode == SEQ_MODE_CC ? 10 : 100;
+    if(Menu_row == 1){
+      edit_step.mode = constrain(edit_step.mode + step, SEQ_MODE_CR, SEQ_MODE_CP + 1);   //one past CP is End
+      unit = 0;
     }
-    else
-    {
-      if(mA_setpoint > voltage_on_load){
-        dac_value = dac_value + 1;
-      }
-
-      if(mA_setpoint < voltage_on_load){
-        dac_value = dac_value - 1;
-      }
+    if(Menu_row <= 2){
+      long max = edit_step.mode == SEQ_MODE_CR ? 9999999L : edit_step.mode == SEQ_MODE_CC ? MAX_SETPOINT_mA : 99999L;
+      edit_step.setpoint = constrain(edit_step.setpoint + step * unit, 0L, max);    //also fits it to a new mode
     }
-    
-    
-    
-    if(dac_value > 4095)
-    {
-      dac_value = 4095;
-    }
-    if(dac_value < 0)
-    {
-      dac_value = 0;
+    else{
+      edit_step.dwell_ms = constrain((long)edit_step.dwell_ms + step * 100L, 100L, 86400000L);
     }
-    
-  
-    if(!pause){
-      dac.setVoltage(dac_value, false);
-      pause_string = "";
+  }
+  if(!encoder_pushed) return;
+  tone(Buzzer, 500, 20);
+  Rotary_counter = 0;
+  Rotary_counter_prev = 0;
+  if(Menu_row == 1 && edit_step.mode > SEQ_MODE_CP){
+    seq_truncate(edit_index);
+    menu_event(Menu_level, MENU_DONE);
+  }
+  else if(Menu_row < 3){
+    Menu_row++;
+  }
+  else if(seq_set(edit_index, edit_step)){
+    Menu_row = 1;
+    if(edit_index + 1 < SEQ_MAX_STEPS){
+      edit_load(edit_index + 1);
     }
     else{
-      dac.setVoltage(0, false);
-      pause_string = " PAUSE";
-    }
-   
-    
-
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print(mA_setpoint,0); lcd.print("mA "); lcd.print(voltage_read); lcd.print("V");
-      lcd.setCursor(0,1);    
-      lcd.print(voltage_on_load,0);  lcd.print("mA"); lcd.print(" "); lcd.print(power_read,0);  lcd.print("mW"); 
-      lcd.print(pause_string);
+      menu_event(Menu_level, MENU_DONE);
     }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string_mA = "____";  
-      mA_setpoint = 0;   
-      mA_0 = 0;
-      mA_1 = 0;
-      mA_2 = 0;      
-    }      
   }
+  else{
+    tone(Buzzer, 200, 200);         //Setpoint out of range for the mode
+  }
+}
 
+void list_edit_draw(){
+  display.print(F("Step ")); display.print(edit_index + 1); display.print(' ');
+  if(Menu_row == 1) display.write(0); else display.print(' ');
+  if(edit_step.mode == SEQ_MODE_CR) display.print(F("CR"));
+  else if(edit_step.mode == SEQ_MODE_CC) display.print(F("CC"));
+  else if(edit_step.mode == SEQ_MODE_CP) display.print(F("CP"));
+  else display.print(F("End"));
+  display.setCursor(0,1);
+  if(edit_step.mode <= SEQ_MODE_CP){
+    if(Menu_row == 2) display.write(0); else display.print(' ');
+    display.print(edit_step.setpoint);
+    if(edit_step.mode == SEQ_MODE_CR) display.write(1);
+    else display.print(edit_step.mode == SEQ_MODE_CC ? F("mA") : F("mW"));
+    display.print(' ');
+    if(Menu_row == 3) display.write(0); else display.print(' ');
+    display.print(edit_step.dwell_ms / 1000.0, 1); display.print('s');
+  }
+}
 
 
 
+//List mode running: the timer interrupt moves through the steps, each sample regulates for the step running
+void list_run_enter(){
+  seq_start();
+}
 
+void list_run_exit(){
+  seq_stop();
+}
 
+void list_run_input(){
+  seq_poll();
+  seq_hold(pause);
+}
 
+void list_run_regulate(){
+  if(seq_status() == SEQ_RUNNING && seq_check(voltage_read, voltage_on_load) && !pause){
+    const SeqStep &step = seq_step();
+    long target = limit_target(target_current(step.mode, step.setpoint));
+    pid_feed_forward(regulator, ff_dac(target));   //Straight to the calibrated DAC value, the PID trims the rest
+    dac_value = pid_update(regulator, target, voltage_on_load);
+    seq_output(dac_value);
+  }
+  else{
+    pid_bumpless(regulator, seq_status() == SEQ_RUNNING ? dac_value : 0);
+    seq_output(0);
+  }
+}
 
+void list_run_draw(){
+  display.print(seq_index() + 1); display.print('/'); display.print(seq_count()); display.print(' ');
+  if(seq_status() == SEQ_RUNNING){
+    const SeqStep &step = seq_step();
+    display.print(step.setpoint);
+    if(step.mode == SEQ_MODE_CR) display.write(1);
+    else display.print(step.mode == SEQ_MODE_CC ? F("mA") : F("mW"));
+    display.print(pause ? F(" OFF") : F(" "));
+    if(!pause) { display.print(seq_remaining_ms() / 1000); display.print('s'); }
+  }
+  else{
+    display.print(seq_status() == SEQ_LIMIT ? F("LIMIT") : F("END"));
+  }
+  display.setCursor(0,1);
+  display.print(display_mV / 1000.0); display.print(F("V ")); print_current();
+}
 
 
-  //Constant Power Mode
-  if(Menu_level == 7)
-  {
-    if(Rotary_counter > Rotary_counter_prev)
-    {
-      mW_setpoint = mW_setpoint + 1;
-      Rotary_counter_prev = Rotary_counter;
-    }
-
-    if(Rotary_counter < Rotary_counter_prev)
-    {
-      mW_setpoint = mW_setpoint - 1;
-      Rotary_counter_prev = Rotary_counter;
-    }
-    
-    float voltage_on_load, voltage_read, power_read;
-      
-    int16_t raw_adc = ads.readADC_Differential_0_1();      //Read DIFFERENTIAL voltage between ADC0 and ADC1
-    
-    // Check for reasonable ADC reading (not floating/disconnected)
-    if(abs(raw_adc) > 32000) {  // If reading is near max range, likely floating
-      voltage_on_load = 0;  // Set to 0 to prevent erratic behavior
-    } else {
-      voltage_on_load = (raw_adc * multiplier)*1000;
-    }
 
-    voltage_read = ads.readADC_SingleEnded(2);
-    voltage_read = (voltage_read * multiplier_A2);
-    
-    //sensosed_voltage = ads.readADC_SingleEnded(3);
-    //sensosed_voltage = (sensosed_voltage * multiplier);
-    
-    power_read = voltage_on_load * voltage_read;
+//DAC calibration: push to sweep the DAC with a supply on the input, the table is saved when it ends
+void cal_exit(){
+  ff_sweep_stop();
+}
 
+void cal_input(){
+  if(encoder_pushed && ff_status() != FF_SWEEP && ff_status() != FF_SAVE){
+    tone(Buzzer, 500, 20);
+    ff_sweep_start();
+  }
+}
 
+void cal_regulate(){
+  ff_sweep_sample(voltage_on_load, voltage_read);
+}
 
+void cal_draw(){
+  uint8_t status = ff_status();
+  if(status == FF_SWEEP){
+    display.print(F("Sweep ")); display.print(ff_point() + 1); display.print('/'); display.print(FF_POINTS);
+  }
+  else if(status == FF_SAVE || status == FF_DONE){
+    display.print(F("Cal done ")); display.print(ff_point()); display.print(F("pts"));
+  }
+  else if(status == FF_FAIL){
+    display.print(F("Cal failed"));
+  }
+  else{
+    display.print(ff_calibrated() ? F("Calibrated") : F("Nominal gain"));
+  }
+  display.setCursor(0,1);
+  if(status == FF_SWEEP || status == FF_FAIL){
+    display.print(display_mV / 1000.0); display.print(F("V ")); print_current();
+  }
+  else{
+    display.print(F("Push to sweep"));
+  }
+}
 
-    float error = abs(mW_setpoint - power_read);    
-    if (error > (mW_setpoint*0.8))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 300;
-      }
 
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 300;
-      }
-    }
 
-    else if (error > (mW_setpoint*0.6))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 170;
-      }
+//Handlers of each Menu_level, indexed by the level: enter, exit, input, regulate, draw
+const MenuState menu_states[] PROGMEM = {
+  {0, 0, 0, 0, 0},                                                            //0: unused
+  {menu_enter, 0, main_input, 0, main_draw},                                  //1: main menu
+  {entry_enter, 0, entry_input, 0, entry_draw},                               //2: CR setpoint entry
+  {entry_enter, 0, entry_input, 0, entry_draw},                               //3: CC setpoint entry
+  {entry_enter, 0, entry_input, 0, entry_draw},                               //4: CP setpoint entry
+  {0, 0, cr_input, cr_regulate, cr_draw},                                     //5: CR
+  {0, 0, cc_input, cc_regulate, cc_draw},                                     //6: CC
+  {0, 0, cp_input, cp_regulate, cp_draw},                                     //7: CP
+  {menu_enter, 0, batt_setup_input, 0, batt_setup_draw},                      //8: battery test setup
+  {batt_enter, 0, 0, batt_regulate, batt_draw},                               //9: battery test
+  {menu_enter, 0, dyn_setup_input, 0, dyn_setup_draw},                        //10: dynamic load setup
+  {dyn_enter, dyn_exit, dyn_input, dyn_regulate, dyn_draw},                   //11: dynamic load
+  {menu_enter, 0, list_input, 0, list_draw},                                  //12: list page
+  {list_edit_enter, 0, list_edit_input, 0, list_edit_draw},                   //13: list editor
+  {list_run_enter, list_run_exit, list_run_input, list_run_regulate, list_run_draw},   //14: list running
+  {menu_enter, cal_exit, cal_input, cal_regulate, cal_draw},                  //15: DAC calibration
+  {entry_enter, 0, entry_input, 0, entry_draw},                               //16: CV setpoint entry
+  {cv_enter, 0, cv_input, cv_regulate, cv_draw},                              //17: CV
+};
+
+//Where the buttons lead. The serial port goes straight to a level (remote_mode()).
+const MenuTransition menu_transitions[] PROGMEM = {
+  {1, MENU_PICK + 1, 2}, {1, MENU_PICK + 2, 3}, {1, MENU_PICK + 3, 4}, {1, MENU_PICK + 4, 16},
+  {1, MENU_PICK + 5, 8}, {1, MENU_PICK + 6, 10}, {1, MENU_PICK + 7, 12}, {1, MENU_PICK + 8, 15},
+  {2, MENU_DONE, 5}, {3, MENU_DONE, 6}, {4, MENU_DONE, 7}, {16, MENU_DONE, 17},
+  {8, MENU_DONE, 9}, {10, MENU_DONE, 11},
+  {12, MENU_DONE, 14}, {12, MENU_EDIT, 13}, {13, MENU_DONE, 12},
+  {2, MENU_BACK, 1}, {3, MENU_BACK, 1}, {4, MENU_BACK, 1}, {16, MENU_BACK, 1},
+  {5, MENU_BACK, 1}, {6, MENU_BACK, 1}, {7, MENU_BACK, 1}, {17, MENU_BACK, 1},
+  {8, MENU_BACK, 1}, {9, MENU_BACK, 1}, {10, MENU_BACK, 1}, {11, MENU_BACK, 1},
+  {12, MENU_BACK, 1}, {13, MENU_BACK, 12}, {14, MENU_BACK, 12}, {15, MENU_BACK, 1},
+};
 
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 170;
-      }
-    }
 
-    else if (error > (mW_setpoint*0.4))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 120;
-      }
 
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 120;
-      }
-    }
-    else if (error > (mW_setpoint*0.3))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 60;
-      }
-
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 60;
-      }
-    }
-    else if (error > (mW_setpoint*0.2))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 40;
-      }
-
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 40;
-      }
-    }
-    else if (error > (mW_setpoint*0.1))
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 30;
-      }
-
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 30;
-      }
-    }
-    else
-    {
-      if(mW_setpoint > power_read){
-        dac_value = dac_value + 1;
-      }
-
-      if(mW_setpoint < power_read){
-        dac_value = dac_value - 1;
-      }
-    }
-    
-    
-    
-    if(dac_value > 4095)
-    {
-      dac_value = 4095;
-    }
-    if(dac_value < 0)
-    {
-      dac_value = 0;
-    }
-    
-  
-    
-    
-    if(!pause){
-      dac.setVoltage(dac_value, false);
-      pause_string = "";
-    }
-    else{
-      dac.setVoltage(0, false);
-      pause_string = " PAUSE";
-    }
-    
-
-    currentMillis = millis();
-    if(currentMillis - previousMillis >= Delay){
-      previousMillis += Delay;
-      lcd.clear();
-      lcd.setCursor(0,0);     
-      lcd.print(mW_setpoint,0); lcd.print("mW "); lcd.print(voltage_read); lcd.print("V");
-      lcd.setCursor(0,1);    
-      lcd.print(power_read,0);  lcd.print("mW"); lcd.print(" "); lcd.print(voltage_on_load,0);  lcd.print("mA"); 
-      lcd.print(pause_string);
-    }
-    if(!digitalRead(SW_blue)){
-      Menu_level = 1;
-      Menu_row = 1;
-      Rotary_counter = 0;
-      Rotary_counter_prev = 0;
-      dac.setVoltage(0, false);
-      previousMillis = millis();
-      SW_STATUS = true;
-      space_string_mA = "____";
-      mW_setpoint = 0;
-      mW_0 = 0;
-      mW_1 = 0;
-      mW_2 = 0;  
-      mW_3 = 0; 
-      mW_4 = 0;     
-    }      
+void setup() {
+  i2c_begin(I2C_CLOCK);       //Start the i2c scheduler before any device is touched
+  telemetry_begin();          //Serial port at TELEMETRY_BAUD
+  Config saved;
+  bool restored = config_load(saved);   //Newest valid settings record, defaults if there is none
+  if(restored){
+    config_apply(saved);
   }
+  lcd.setAddress(lcd_address);
+  lcd.begin(lcd_chars, 3);    //Only starts the LCD power up, loop() carries it on (lcd.poll) while the load already runs
+  tone(Buzzer, 500, 100);     //First note of the start up tune, the rest is played by loop()
+  
+  encoder_begin();            //Pins 9, 10 as input and their pin change interrupt (see encoder.h)
+  pinMode(Buzzer,OUTPUT);     //Buzzer pin set as OUTPUT
+  pinMode(SW,INPUT_PULLUP);       //Encoder button set as input with pullup
+  pinMode(SW_blue,INPUT_PULLUP);  //Menu button set as input with pullup
+  pinMode(SW_red,INPUT_PULLUP);   //Stop/resume button set as input with pullup
 
+  
+  ads.begin(ADS1115_ADDRESS);   //Start i2c communication with the ADC
+  protect_begin(multiplier, multiplier_shift, voltage_multiplier(), multiplier_A2_shift);   //Armed before the first result
+  therm_begin();    //Fan off until the first temperature
+  acq_begin();      //Start converting current and voltage in the background (see acquisition.h)
 
+  dac.begin(dac_address);   //Start i2c communication with the DAC
+  dac.setVoltage(0, false); //Set DAC voltage output to 0V (MOSFET turned off)
+  pid_init(regulator, PID_KP, PID_KI, PID_KD);
+  filter_select(Menu_level);  //Filters of the mode we start in
+  menu_begin(menu_states, sizeof(menu_states) / sizeof(menu_states[0]), menu_transitions,
+             sizeof(menu_transitions) / sizeof(menu_transitions[0]), menu_change);
+  ff_begin();       //DAC to current table from the EEPROM (nominal gain if there is none)
+
+  if(restored && run_level(saved.mode)){
+    pause = true;             //Back in the mode that ran before the power cycle, with the input off
+    remote_mode(saved.mode);
+  }
+   
+  previousMillis = millis();
 
+}
 
+//Start up tune and splash screen, played out by loop() so setup() does not wait for them
+void boot_poll(){
+  static uint8_t notes = 1;           //The first one was started by setup()
+  static bool splash = true;
+  unsigned long now = millis();
+  if(notes < 3 && now >= notes * 100UL){
+    tone(Buzzer, notes == 1 ? 700 : 1200, 100);
+    notes++;
+  }
+  if(!splash) return;
+  if(now >= SPLASH_MS || Menu_level != 1 || Rotary_counter != 0 || encoder_pushed){
+    splash = false;
+    previousMillis = now - Delay;     //Draw the menu right away
+    return;
+  }
+  display.clear();
+  display.setCursor(0,0);
+  display.print(F("  ELECTRONOOBS  "));
+  display.setCursor(0,1);
+  display.print(F("ELECTRONIC  LOAD"));
+}
 
+void loop() {
+  prof_loop();                        //Loop period statistics (profile.h)
+  unsigned long phase_start = prof_start();
+  bool new_pair = acq_poll();         //Never blocks, true when a new current/voltage pair is ready
+  if(Menu_level != filter_level){
+    filter_select(Menu_level);        //Every mode starts with its own filters, empty
+  }
+  bool new_sample = new_pair && filter_sample();    //The regulation runs on the filter outputs
+  int16_t temp_raw;
+  if(acq_temperature(temp_raw)){
+    therm_sample(temp_raw);           //Fan, derating and the over-temperature trip, about 3 times a second
+  }
+  int16_t terminal_raw;
+  if(acq_terminal(terminal_raw)){     //Sense leads against the load terminals, trips when one is off
+    AcqSample sample;
+    acq_latest(sample);
+    sense_check(terminal_raw, cal_apply_fine(sample.voltage, voltage_multiplier(), multiplier_A2_shift));
+  }
+  prof_end(PROF_ADC, phase_start);
+  unsigned long pair_us = 0;          //When the pair the regulation works on was completed
+  if(new_sample && PROFILE){
+    AcqSample sample;
+    acq_latest(sample);
+    pair_us = sample.stamp_us;
+  }
 
+  phase_start = prof_start();
+  scpi_poll();                        //Remote commands, never waits
+  nvm_poll();                         //One EEPROM byte at a time, never waits
+  config_write();                     //The settings being saved, as the EEPROM queue has room
+  ff_poll();                          //Saves a new calibration table after a sweep
+  if(config_due()){                   //Settings that changed and then stayed put are saved (config.h)
+    Config c;
+    config_collect(c);
+    config_poll(c);
+  }
+  prof_end(PROF_REMOTE, phase_start);
 
+  phase_start = prof_start();
+  int8_t steps = encoder_read();      //Steps counted by the encoder interrupt since the last pass
+  if(steps){
+    Rotary_counter += steps;
+    tone(Buzzer, 700, 5);             //Click here, tone() is too slow for the interrupt
+  }
+  
+  encoder_pushed = menu_button(encoder_button);   //Each button read once per pass, debounced (menu.h)
+  bool blue_pressed = menu_button(blue_button);
+  if(menu_button(red_button)){
+    tone(Buzzer, 1000, 300);
+    if(protect_tripped()){
+      protect_clear();                //Acknowledge the trip, the load stays paused until the next push
+    }
+    else{
+      pause = !pause;
+    }
+  }
+  prof_end(PROF_BUTTONS, phase_start);
+
+  uint8_t trip = protect_tripped();   //The interrupt has already turned the DAC off, the modes only follow
+  if(trip){
+    if(trip != trip_seen){
+      tone(Buzzer, 2000, 500);
+      if(Menu_level == 15) ff_sweep_stop();
+      if(Menu_level == 17) cv_start(0);         //Probe the source again on resume
+    }
+    pause = true;
+    dac_value = 0;
+    pid_bumpless(regulator, 0);       //Resume starts from 0, not from the code that tripped
+  }
+  trip_seen = trip;
 
+  
 
+  
+  if(blue_pressed){
+    menu_event(Menu_level, MENU_BACK);
+  }
+  menu_input(Menu_level);             //Encoder and push of the state the menu is in (menu.h)
+  if(new_sample){                     //Regulate once per new current/voltage pair
+    read_measurement();
+    menu_regulate(Menu_level);
+  }
+  currentMillis = millis();
+  if(currentMillis - previousMillis >= Delay){
+    previousMillis += Delay;
+    display.clear();
+    menu_draw(Menu_level);
+  }
 
 
 
+  if(new_sample){
+    prof_end(PROF_CONTROL, pair_us);  //The new DAC code is queued by now
+  }
 
+  if(trip && Menu_level != 1){        //Over the bottom line of whatever the mode shows, until acknowledged
+    display.setCursor(0,1);
+    print_P(protect_name(trip)); display.print(F(" TRIP  RED=OK "));
+  }
 
-}//end void loop
+  if(new_pair){                       //One telemetry frame per ADC pair, raw (before the filters)
+    AcqSample sample;
+    acq_latest(sample);
+    uint8_t flags = 0;
+    if(pause) flags |= TLM_FLAG_PAUSE;
+    if(abs(sample.current) > ACQ_OVERRANGE) flags |= TLM_FLAG_OVERRANGE;
+    if(Menu_level == 9 && batt_ended()) flags |= TLM_FLAG_CUTOFF;
+    if(trip) flags |= TLM_FLAG_TRIP;
+    telemetry_send(sample, dac.lastValue(), Menu_level, flags);
+  }
 
+  boot_poll();                //Start up tune and splash, over the menu until SPLASH_MS or the first input
 
+  phase_start = prof_start();
+  lcd.poll();                 //LCD power up sequence, nothing once it is done
+  display.refresh();          //Queue changed characters while the LCD queue has room, never waits
+  prof_end(PROF_LCD, phase_start);
 
 
 
-ISR(PCINT0_vect){  
-cli(); //stop interrupts happening before we read pin values
-clk_State =   (PINB & B00000100); //pin 10 state? 
-dt_State  =   (PINB & B00000010); 
-if (clk_State != Last_State){
-  // If the outputB state is different to the outputA state, that means the encoder is rotating clockwise
-  if (dt_State != clk_State){ 
-    Rotary_counter ++;    
-    tone(Buzzer, 700, 5);
-    Last_State = clk_State; // Updates the previous state of the outputA with the current state
-    sei(); //restart interrupts
-  }
-  else {
-    Rotary_counter --;  
-    tone(Buzzer, 700, 5); 
-    Last_State = clk_State; // Updates the previous state of the outputA with the current state    
-    sei(); //restart interrupts
-  } 
- }  
-}
+}//end void loop
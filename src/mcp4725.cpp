@@ -0,0 +1,90 @@
+#include "mcp4725.h"
+
+#define CMD_FAST_WRITE        0x00      //C2 C1 = 00, PD1 PD0 = 00 (normal mode) in the upper nibble
+#define CMD_WRITE_DAC_EEPROM  0x60
+
+#define MCP4725_UNKNOWN       0xFFFF    //output of the DAC is not known (power up value, failed write)
+
+static void mcp4725_fill(I2cTransaction &t, uint16_t output, bool eeprom)
+{
+  if(!eeprom){                          //fast write: two bytes instead of three
+    t.tx_len = 2;
+    t.tx[0] = CMD_FAST_WRITE | (output >> 8);
+    t.tx[1] = output & 0xFF;
+    return;
+  }
+  t.tx_len = 3;
+  t.tx[0] = CMD_WRITE_DAC_EEPROM;
+  t.tx[1] = output >> 4;                //upper 8 bits
+  t.tx[2] = (output & 0x0F) << 4;       //lower 4 bits, left aligned
+}
+
+#if PROFILE
+static void mcp4725_done(I2cTransaction &t)
+{
+  prof_record(PROF_DAC, (uint16_t)((uint16_t)micros() - t.queued_us));
+}
+#else
+#define mcp4725_done 0
+#endif
+
+void Mcp4725::begin(uint8_t i2c_address)
+{
+  address = i2c_address;
+  sent = MCP4725_UNKNOWN;               //the DAC comes up with whatever its EEPROM holds
+  for(uint8_t i = 0; i < 2; i++){
+    txn[i].address = address;
+    txn[i].tx_len = 2;
+    txn[i].rx_len = 0;
+    txn[i].done = mcp4725_done;
+  }
+}
+
+void Mcp4725::setVoltage(uint16_t output, bool writeEEPROM)
+{
+  if(output > 4095) output = 4095;
+  uint8_t sreg = SREG;
+  cli();
+  if(locked) output = 0;
+  value = output;
+  for(uint8_t i = 0; i < 2; i++){       //a write that was not acknowledged leaves the DAC unknown
+    if(txn[i].status == I2C_ERROR){
+      txn[i].status = I2C_IDLE;
+      sent = MCP4725_UNKNOWN;
+    }
+  }
+  if(output == sent && !writeEEPROM){   //already on the DAC or on its way there
+    SREG = sreg;
+    return;
+  }
+  sent = output;
+  for(uint8_t i = 0; i < 2; i++){       //a write still waiting for the bus just takes the new value
+    if(txn[i].status == I2C_QUEUED){
+      mcp4725_fill(txn[i], output, writeEEPROM);
+      SREG = sreg;
+      return;
+    }
+  }
+  for(uint8_t i = 0; i < 2; i++){
+    if(txn[i].status != I2C_BUSY){
+      mcp4725_fill(txn[i], output, writeEEPROM);
+      i2c_submit(txn[i], I2C_PRIO_HIGH);
+      break;
+    }
+  }
+  SREG = sreg;
+}
+
+void Mcp4725::shutdown()
+{
+  uint8_t sreg = SREG;
+  cli();
+  locked = true;
+  setVoltage(0, false);
+  SREG = sreg;
+}
+
+void Mcp4725::release()
+{
+  locked = false;
+}
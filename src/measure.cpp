@@ -0,0 +1,21 @@
+#include "measure.h"
+
+void recip_set(Reciprocal &r, uint32_t divisor)
+{
+  r.divisor = divisor;
+  //largest shift that keeps num = 2^shift / divisor below 2^15, so x * num fits 32 bits for x < 2^17
+  uint8_t shift = 15;
+  while(shift < 47 && ((uint64_t)1 << (shift + 1)) / divisor < 32768){
+    shift++;
+  }
+  r.shift = shift;
+  r.num = (((uint64_t)1 << shift) + divisor / 2) / divisor;
+}
+
+uint32_t recip_div(const Reciprocal &r, uint32_t x)
+{
+  if(r.shift > 31){                     //divisor above 2^16: only x >= divisor / 2 rounds to more than 0
+    return (x * r.num) >> 16 >> (r.shift - 16);
+  }
+  return (x * r.num + ((uint32_t)1 << (r.shift - 1))) >> r.shift;
+}
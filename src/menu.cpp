@@ -0,0 +1,82 @@
+#include "menu.h"
+
+static const MenuState *states = 0;
+static uint8_t state_count = 0;
+static const MenuTransition *transitions = 0;
+static uint8_t transition_count = 0;
+static MenuHandler on_change = 0;
+
+
+//Handler `field` of the row of `level`, 0 when there is none
+static MenuHandler menu_handler(int level, const MenuHandler MenuState::*field)
+{
+  if(level < 0 || level >= state_count) return 0;
+  return (MenuHandler)pgm_read_ptr(&(states[level].*field));
+}
+
+static void menu_call(int level, const MenuHandler MenuState::*field)
+{
+  MenuHandler handler = menu_handler(level, field);
+  if(handler) handler();
+}
+
+void menu_begin(const MenuState *state_table, uint8_t states_in_table, const MenuTransition *transition_table,
+                uint8_t transitions_in_table, MenuHandler change)
+{
+  states = state_table;
+  state_count = states_in_table;
+  transitions = transition_table;
+  transition_count = transitions_in_table;
+  on_change = change;
+}
+
+void menu_goto(int &level, uint8_t to)
+{
+  menu_call(level, &MenuState::exit);
+  if(on_change) on_change();
+  level = to;
+  menu_call(level, &MenuState::enter);
+}
+
+bool menu_event(int &level, uint8_t event)
+{
+  for(uint8_t i = 0; i < transition_count; i++){
+    if(pgm_read_byte(&transitions[i].from) != level || pgm_read_byte(&transitions[i].event) != event) continue;
+    menu_goto(level, pgm_read_byte(&transitions[i].to));
+    return true;
+  }
+  return false;
+}
+
+void menu_input(int level)
+{
+  menu_call(level, &MenuState::input);
+}
+
+void menu_regulate(int level)
+{
+  menu_call(level, &MenuState::regulate);
+}
+
+void menu_draw(int level)
+{
+  menu_call(level, &MenuState::draw);
+}
+
+bool menu_button(MenuButton &button)
+{
+  bool low = !digitalRead(button.pin);
+  if(low == button.down){
+    button.changing = false;
+    return false;
+  }
+  unsigned long now = millis();
+  if(!button.changing){
+    button.changing = true;
+    button.since = now;
+  }
+  if(now - button.since < MENU_DEBOUNCE_MS) return false;
+  button.changing = false;
+  button.down = low;
+  return low;
+}
@@ -0,0 +1,95 @@
+#include "nvm.h"
+
+struct NvmByte {
+  uint16_t address;
+  uint8_t value;
+};
+
+static NvmByte queue[NVM_QUEUE_LEN];
+static uint8_t head = 0, count = 0;
+
+
+uint8_t nvm_free()
+{
+  return NVM_QUEUE_LEN - count;
+}
+
+bool nvm_idle()
+{
+  return count == 0;
+}
+
+bool nvm_write(uint16_t address, const void *data, uint8_t len)
+{
+  if(len > nvm_free()) return false;
+  const uint8_t *bytes = (const uint8_t *)data;
+  //Only the end of the queue that holds nothing but this record may take new values in place, a byte that
+  //moved ahead of another write would reach the EEPROM before it
+  uint8_t merge = count;
+  while(merge){
+    uint16_t queued = queue[(head + merge - 1) % NVM_QUEUE_LEN].address;
+    if(queued < address || queued >= address + len) break;
+    merge--;
+  }
+  for(uint8_t i = 0; i < len; i++){
+    uint8_t slot = merge;
+    for(; slot < count; slot++){            //the same address already queued just takes the new value
+      if(queue[(head + slot) % NVM_QUEUE_LEN].address == address + i) break;
+    }
+    NvmByte &b = queue[(head + slot) % NVM_QUEUE_LEN];
+    if(slot == count) count++;
+    b.address = address + i;
+    b.value = bytes[i];
+  }
+  return true;
+}
+
+void nvm_read(uint16_t address, void *data, uint8_t len)
+{
+  uint8_t *bytes = (uint8_t *)data;
+  for(uint8_t i = 0; i < len; i++){
+    bytes[i] = nvm_hw_read(address + i);
+  }
+  for(uint8_t slot = 0; slot < count; slot++){
+    const NvmByte &b = queue[(head + slot) % NVM_QUEUE_LEN];
+    if(b.address >= address && b.address < address + len){
+      bytes[b.address - address] = b.value;
+    }
+  }
+}
+
+void nvm_poll()
+{
+  while(count && nvm_hw_ready()){
+    const NvmByte &b = queue[head];
+    bool changed = nvm_hw_read(b.address) != b.value;
+    if(changed){
+      nvm_hw_write(b.address, b.value);
+    }
+    head = (head + 1) % NVM_QUEUE_LEN;
+    count--;
+    if(changed) break;                      //one write at a time, the next one once it is done
+  }
+}
+
+
+
+#ifdef __AVR__
+/////////////////////////////EEPROM hardware layer//////////////////////////////////
+#include <avr/eeprom.h>
+
+bool nvm_hw_ready()
+{
+  return eeprom_is_ready();
+}
+
+uint8_t nvm_hw_read(uint16_t address)
+{
+  return eeprom_read_byte((const uint8_t *)address);
+}
+
+void nvm_hw_write(uint16_t address, uint8_t value)
+{
+  eeprom_write_byte((uint8_t *)address, value);     //returns at once, the EEPROM is ready
+}
+#endif
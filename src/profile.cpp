@@ -0,0 +1,73 @@
+#include "profile.h"
+
+#if PROFILE
+
+static ProfStat stats[PROF_PHASES];
+static unsigned long loop_start_us = 0;
+static bool loop_started = false;
+
+
+//Histogram bucket of a time: below 8us, then one per power of two up to the last
+static uint8_t prof_bucket(uint16_t us)
+{
+  uint8_t bucket = 0;
+  us >>= 3;
+  while(us && bucket < PROF_BUCKETS - 1){
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+void prof_record(uint8_t phase, unsigned long us)
+{
+  uint16_t t = us > 65535 ? 65535 : us;
+  uint8_t bucket = prof_bucket(t);
+  uint8_t sreg = SREG;                  //also called from the I2C interrupt
+  cli();
+  ProfStat &s = stats[phase];
+  if(!s.count || t < s.min) s.min = t;
+  if(t > s.max) s.max = t;
+  if(s.count == 0xFFFF){
+    s.count >>= 1;
+    s.sum >>= 1;
+  }
+  s.count++;
+  s.sum += t;
+  if(s.hist[bucket] != 0xFFFF) s.hist[bucket]++;
+  SREG = sreg;
+}
+
+void prof_end(uint8_t phase, unsigned long start)
+{
+  prof_record(phase, micros() - start);
+}
+
+void prof_loop()
+{
+  unsigned long now = micros();
+  if(loop_started){
+    prof_record(PROF_LOOP, now - loop_start_us);
+  }
+  loop_start_us = now;
+  loop_started = true;
+}
+
+void prof_get(uint8_t phase, ProfStat &stat)
+{
+  uint8_t sreg = SREG;
+  cli();
+  stat = stats[phase];
+  SREG = sreg;
+}
+
+void prof_reset()
+{
+  uint8_t sreg = SREG;
+  cli();
+  memset(stats, 0, sizeof(stats));
+  loop_started = false;                 //the pass running now is not a whole period
+  SREG = sreg;
+}
+
+#endif
@@ -0,0 +1,113 @@
+#include "protect.h"
+#include "mcp4725.h"
+#include "measure.h"
+
+extern Mcp4725 dac;
+
+static int32_t current_num = 1, voltage_num = 1;
+static uint8_t current_shift = 0, voltage_shift = 0;
+static long limits[4] = {PROTECT_OCP_mA, PROTECT_OPP_mW, PROTECT_UVP_mV, PROTECT_OVP_mV};
+
+//What the interrupt compares with, worked out by protect_set()
+static int16_t ocp_raw = 0;             //0 = off
+static int32_t opp_uW = 0;
+static int16_t uvp_raw = 0;
+static int16_t ovp_raw = 0;
+static volatile uint8_t tripped = 0;
+
+
+static uint8_t protect_index(uint8_t which)
+{
+  uint8_t i = 0;
+  while(which > 1 && i < 3){
+    which >>= 1;
+    i++;
+  }
+  return i;
+}
+
+//Raw counts of `value` (mA or mV), at least 1 so a limit that is set never reads as off
+static int16_t protect_raw(long value, int32_t num, uint8_t shift)
+{
+  uint32_t raw = ((uint32_t)value << shift) / (uint32_t)num;
+  if(raw > 32767) raw = 32767;
+  return raw ? raw : 1;
+}
+
+void protect_begin(int32_t cur_num, uint8_t cur_shift, int32_t volt_num, uint8_t volt_shift)
+{
+  current_num = cur_num;
+  current_shift = cur_shift;
+  voltage_num = volt_num;
+  voltage_shift = volt_shift;
+  for(uint8_t i = 0; i < 4; i++){
+    protect_set(1 << i, limits[i]);
+  }
+}
+
+void protect_set(uint8_t which, long limit)
+{
+  if(limit < 0) limit = 0;
+  limits[protect_index(which)] = limit;
+  uint8_t sreg = SREG;                  //the interrupt reads these
+  cli();
+  if(which == PROTECT_OCP) ocp_raw = limit ? protect_raw(limit, current_num, current_shift) : 0;
+  if(which == PROTECT_OPP) opp_uW = limit * 1000;
+  if(which == PROTECT_UVP) uvp_raw = limit ? protect_raw(limit, voltage_num, voltage_shift) : 0;
+  if(which == PROTECT_OVP) ovp_raw = limit ? protect_raw(limit, voltage_num, voltage_shift) : 0;
+  SREG = sreg;
+}
+
+long protect_limit(uint8_t which)
+{
+  return limits[protect_index(which)];
+}
+
+void protect_check(int16_t current_raw, int16_t voltage_raw)
+{
+  uint8_t cause = 0;
+  if(ocp_raw && current_raw > ocp_raw) cause |= PROTECT_OCP;
+  if(ovp_raw && voltage_raw > ovp_raw) cause |= PROTECT_OVP;
+  if(uvp_raw && voltage_raw < uvp_raw && dac.lastValue() != 0) cause |= PROTECT_UVP;
+  if(opp_uW && current_raw > 0 && voltage_raw > 0 &&
+     cal_apply(current_raw, current_num, current_shift) * cal_apply(voltage_raw, voltage_num, voltage_shift) > opp_uW){
+    cause |= PROTECT_OPP;
+  }
+  if(cause){
+    protect_trip(cause);
+  }
+}
+
+void protect_trip(uint8_t cause)
+{
+  uint8_t sreg = SREG;
+  cli();
+  tripped |= cause;
+  dac.shutdown();                       //queued ahead of the LCD, and every write from now on is 0
+  SREG = sreg;
+}
+
+uint8_t protect_tripped()
+{
+  return tripped;
+}
+
+void protect_clear()
+{
+  uint8_t sreg = SREG;
+  cli();
+  tripped = 0;
+  dac.release();
+  SREG = sreg;
+}
+
+const char *protect_name(uint8_t bits)
+{
+  if(bits & PROTECT_OCP) return PSTR("OCP");
+  if(bits & PROTECT_OPP) return PSTR("OPP");
+  if(bits & PROTECT_UVP) return PSTR("UVP");
+  if(bits & PROTECT_OVP) return PSTR("OVP");
+  if(bits & PROTECT_OTP) return PSTR("OTP");
+  if(bits & PROTECT_SENSE) return PSTR("SNS");
+  return PSTR("");
+}
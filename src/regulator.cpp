@@ -0,0 +1,85 @@
+#include "regulator.h"
+
+void pid_init(Pid &pid, int16_t kp, int16_t ki, int16_t kd)
+{
+  pid_set_gains(pid, kp, ki, kd);
+  pid_set_hold(pid, PID_FF_HOLD);
+  pid_bumpless(pid, 0);
+}
+
+void pid_set_gains(Pid &pid, int16_t kp, int16_t ki, int16_t kd)
+{
+  pid.kp = kp;
+  pid.ki = ki;
+  pid.kd = kd;
+}
+
+void pid_set_hold(Pid &pid, uint8_t samples)
+{
+  pid.hold_samples = samples;
+}
+
+void pid_bumpless(Pid &pid, int16_t output)
+{
+  if(output < PID_DAC_MIN) output = PID_DAC_MIN;
+  if(output > PID_DAC_MAX) output = PID_DAC_MAX;
+  pid.integral = (int32_t)output << 8;
+  pid.out = output;
+  pid.restart = true;
+  pid.ff = -1;
+  pid.hold = 0;
+}
+
+void pid_feed_forward(Pid &pid, int16_t code)
+{
+  if(pid.ff >= 0 && abs(code - pid.ff) <= PID_FF_DEADBAND){
+    return;                                       //noise on the target (CR, CP): the integrator has it
+  }
+  int32_t integral = (int32_t)code << 8;          //first prediction: start from it
+  if(pid.ff < 0 || abs(code - pid.ff) > PID_FF_JUMP){
+    pid.hold = pid.hold_samples;
+  }
+  if(pid.ff >= 0){
+    integral = pid.integral + ((int32_t)(code - pid.ff) << 8);   //keep the correction the integrator learned
+  }
+  if(integral < ((int32_t)PID_DAC_MIN << 8)) integral = (int32_t)PID_DAC_MIN << 8;
+  if(integral > ((int32_t)PID_DAC_MAX << 8)) integral = (int32_t)PID_DAC_MAX << 8;
+  pid.integral = integral;
+  pid.ff = code;
+}
+
+int16_t pid_update(Pid &pid, int32_t setpoint, int32_t measured)
+{
+  if(pid.hold){
+    pid.hold--;
+    pid.restart = true;
+    pid.out = (pid.integral + 128) >> 8;
+    return pid.out;
+  }
+  int32_t error = setpoint - measured;
+
+  int32_t derivative = 0;
+  if(!pid.restart){
+    derivative = measured - pid.prev_measured;
+  }
+  pid.prev_measured = measured;
+  pid.restart = false;
+
+  int32_t step = (int32_t)pid.ki * error;
+  int32_t integral = pid.integral + step;
+  if(integral < ((int32_t)PID_DAC_MIN << 8)) integral = (int32_t)PID_DAC_MIN << 8;
+  if(integral > ((int32_t)PID_DAC_MAX << 8)) integral = (int32_t)PID_DAC_MAX << 8;
+
+  int32_t out = integral + (int32_t)pid.kp * error - (int32_t)pid.kd * derivative;
+  out = (out + 128) >> 8;
+
+  //Anti-windup: only keep the new integral if the output is not pushed further into the limit
+  if(!((out > PID_DAC_MAX && error > 0) || (out < PID_DAC_MIN && error < 0))){
+    pid.integral = integral;
+  }
+
+  if(out < PID_DAC_MIN) out = PID_DAC_MIN;
+  if(out > PID_DAC_MAX) out = PID_DAC_MAX;
+  pid.out = out;
+  return pid.out;
+}
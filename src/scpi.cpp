@@ -0,0 +1,747 @@
+#include "scpi.h"
+#include "uart.h"
+#include "telemetry.h"
+#include "regulator.h"
+#include "battery.h"
+#include "dynamic.h"
+#include "sequence.h"
+#include "nvm.h"
+#include "feedforward.h"
+#include "profile.h"
+#include "protect.h"
+#include "thermal.h"
+#include "acquisition.h"
+#include "sense.h"
+#include "cv.h"
+
+//State owned by main.cpp
+extern int Menu_level;
+extern bool pause;
+extern long ohm_setpoint, mA_setpoint, mW_setpoint, mV_setpoint, batt_cutoff_mV;
+extern long dyn_level1_mA, dyn_level2_mA, dyn_freq_mHz, dyn_duty, dyn_slew;
+extern long voltage_on_load, voltage_read, power_read, current_uA;
+extern int32_t multiplier;
+extern uint8_t lcd_address, dac_address;
+void remote_mode(int level);
+void set_calibration(int32_t current_num, int32_t voltage_num);
+int32_t &voltage_multiplier();
+void set_remote_sense(bool remote);
+
+#define SCPI_ERR_NONE         0
+#define SCPI_ERR_HEADER       -113        //undefined header
+#define SCPI_ERR_DATA         -104        //data type error (missing or not a number)
+#define SCPI_ERR_RANGE        -222        //data out of range
+#define SCPI_ERR_CONFLICT     -221        //settings conflict (list empty or running)
+#define SCPI_ERR_TOO_LONG     -223        //too much data (line longer than SCPI_LINE_LEN)
+#define SCPI_ERR_OVERRUN      -363        //input buffer overrun (received bytes were lost)
+#define SCPI_ERR_QUEUE_LEN    4
+
+static char line[SCPI_LINE_LEN + 1];
+static uint8_t line_len = 0;
+static bool line_overflow = false;
+static bool line_done = false;            //a whole line is in `line`, waiting for the one before it
+static char held[SCPI_LINE_LEN + 1];      //rest of a line whose command waits for room in the EEPROM queue
+static bool holding = false;
+static bool hold = false;                 //set by the command running: retry it later
+static char reply[SCPI_REPLY_LEN];        //waiting for room in the UART
+static uint8_t reply_len = 0;
+static int16_t errors[SCPI_ERR_QUEUE_LEN];
+static uint8_t error_count = 0;
+
+
+static void scpi_error(int16_t code)
+{
+  if(error_count < SCPI_ERR_QUEUE_LEN){
+    errors[error_count++] = code;
+  }
+}
+
+//For commands that save: false, and the command is run again later, while the EEPROM queue has no room
+static bool nvm_room(uint8_t bytes)
+{
+  if(nvm_free() >= bytes) return true;
+  hold = true;
+  return false;
+}
+
+/////////////////////////////Reply formatting//////////////////////////////////
+
+static void put_char(char c)
+{
+  if(reply_len < SCPI_REPLY_LEN - 1) reply[reply_len++] = c;     //the last byte is kept for the LF
+}
+
+//Text kept in flash (PSTR), every reply string is
+static void put_P(const char *s)
+{
+  char c;
+  while((c = pgm_read_byte(s++))) put_char(c);
+}
+
+static void put_long(long value)
+{
+  char digits[11];
+  uint8_t n = 0;
+  if(value < 0){
+    put_char('-');
+    value = -value;
+  }
+  do{
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while(value);
+  while(n) put_char(digits[--n]);
+}
+
+//Thousandths as a decimal number, 1234 -> 1.234
+static void put_milli(long value)
+{
+  if(value < 0){
+    put_char('-');
+    value = -value;
+  }
+  put_long(value / 1000);
+  put_char('.');
+  long frac = value % 1000;
+  put_char('0' + frac / 100);
+  put_char('0' + frac / 10 % 10);
+  put_char('0' + frac % 10);
+}
+
+//Millionths as a decimal number, 1234 -> 0.001234
+static void put_micro(long value)
+{
+  if(value < 0){
+    put_char('-');
+    value = -value;
+  }
+  put_long(value / 1000000);
+  put_char('.');
+  long frac = value % 1000000;
+  for(long digit = 100000; digit; digit /= 10){
+    put_char('0' + frac / digit % 10);
+  }
+}
+
+static void put_sep()
+{
+  put_char(',');
+}
+
+/////////////////////////////Parsing//////////////////////////////////
+
+static bool is_alpha(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+static char upper(char c)
+{
+  return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+static void skip_spaces(const char *&p)
+{
+  while(*p == ' ' || *p == '\t') p++;
+}
+
+static bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+//True if the keyword at p is spec in its short form (the leading capitals) or its long form, then p moves past it.
+//A numeric suffix in spec ("LEVel1") must follow either form. spec is in flash (PSTR) and ends at its 0 or at
+//a ':', so header() can match a whole path one keyword at a time without copying it.
+static bool keyword(const char *&p, const char *spec)
+{
+  uint8_t len = 0;
+  while(is_alpha(p[len]) || p[len] == '*') len++;
+  uint8_t spec_len = 0;
+  char c;
+  while((c = pgm_read_byte(spec + spec_len)) && c != ':' && !is_digit(c)) spec_len++;
+  uint8_t short_len = 0;
+  while(short_len < spec_len && !((c = pgm_read_byte(spec + short_len)) >= 'a' && c <= 'z')) short_len++;
+  if(len != short_len && len != spec_len) return false;
+  for(uint8_t i = 0; i < len; i++){
+    if(upper(p[i]) != upper(pgm_read_byte(spec + i))) return false;
+  }
+  const char *suffix = spec + spec_len;
+  uint8_t n = 0;
+  for(; (c = pgm_read_byte(suffix + n)) && c != ':'; n++){
+    if(p[len + n] != c) return false;
+  }
+  if(is_digit(p[len + n])) return false;
+  p += len + n;
+  return true;
+}
+
+//True if the header at p is `spec` (keywords separated by ':', in flash), then p moves past it and query tells
+//if it ended with '?'
+static bool header(const char *&p, const char *spec, bool &query)
+{
+  const char *q = p;
+  char c;
+  while(pgm_read_byte(spec)){
+    if(!keyword(q, spec)) return false;
+    while((c = pgm_read_byte(spec)) && c != ':') spec++;
+    if(c == ':'){
+      spec++;
+      if(*q != ':') return false;
+      q++;
+    }
+  }
+  query = (*q == '?');
+  if(query) q++;
+  if(*q && *q != ' ' && *q != '\t') return false;
+  p = q;
+  return true;
+}
+
+//Decimal number scaled by 10^decimals and rounded ("1.5", 3 -> 1500), optional sign
+static bool number(const char *&p, long &value, uint8_t decimals)
+{
+  skip_spaces(p);
+  bool negative = (*p == '-');
+  if(*p == '-' || *p == '+') p++;
+  if(!((*p >= '0' && *p <= '9') || *p == '.')) return false;
+  long result = 0;
+  while(*p >= '0' && *p <= '9'){
+    if(result > 99999999L) return false;
+    result = result * 10 + (*p++ - '0');
+  }
+  uint8_t n = 0;
+  bool round_up = false;
+  if(*p == '.'){
+    p++;
+    while(*p >= '0' && *p <= '9'){
+      if(n < decimals){
+        if(result > 99999999L) return false;
+        result = result * 10 + (*p - '0');
+        n++;
+      }
+      else if(n == decimals){
+        round_up = (*p >= '5');
+        n++;
+      }
+      p++;
+    }
+  }
+  for(; n < decimals; n++){
+    if(result > 99999999L) return false;
+    result *= 10;
+  }
+  if(round_up) result++;
+  value = negative ? -result : result;
+  return true;
+}
+
+//',' between arguments
+static bool comma(const char *&p)
+{
+  skip_spaces(p);
+  if(*p != ',') return false;
+  p++;
+  return true;
+}
+
+//ON/OFF/1/0
+static bool boolean_arg(const char *&p, bool &value)
+{
+  skip_spaces(p);
+  if(keyword(p, PSTR("ON"))) value = true;
+  else if(keyword(p, PSTR("OFF"))) value = false;
+  else if(*p == '1' || *p == '0') value = (*p++ == '1');
+  else return false;
+  return true;
+}
+
+static const char *mode_name(int level)
+{
+  if(level == 5) return PSTR("CR");
+  if(level == 6) return PSTR("CC");
+  if(level == 7) return PSTR("CP");
+  if(level == 17) return PSTR("CV");
+  if(level == 9) return PSTR("BATT");
+  if(level == 11) return PSTR("DYN");
+  if(level == 14) return PSTR("LIST");
+  if(level == 15) return PSTR("CAL");
+  return PSTR("OFF");
+}
+
+//PROF phase argument, PROF_PHASES if it is none of them
+static uint8_t profile_phase(const char *&p)
+{
+  skip_spaces(p);
+  if(keyword(p, PSTR("LOOP"))) return PROF_LOOP;
+  if(keyword(p, PSTR("ADC"))) return PROF_ADC;
+  if(keyword(p, PSTR("CONTrol"))) return PROF_CONTROL;
+  if(keyword(p, PSTR("DAC"))) return PROF_DAC;
+  if(keyword(p, PSTR("LCD"))) return PROF_LCD;
+  if(keyword(p, PSTR("BUTTons"))) return PROF_BUTTONS;
+  if(keyword(p, PSTR("REMote"))) return PROF_REMOTE;
+  if(keyword(p, PSTR("BUS"))) return PROF_BUS;
+  return PROF_PHASES;
+}
+
+//PROF:STAT? <phase> answers samples,min,mean,max in us, PROF:HIST? <phase> the bucket counts
+static void profile_query(const char *p, bool histogram)
+{
+  uint8_t phase = profile_phase(p);
+  if(phase == PROF_PHASES){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  ProfStat stat;
+  prof_get(phase, stat);
+  if(histogram){
+    for(uint8_t i = 0; i < PROF_BUCKETS; i++){
+      if(i) put_sep();
+      put_long(stat.hist[i]);
+    }
+    return;
+  }
+  put_long(stat.count); put_sep();
+  put_long(stat.min); put_sep();
+  put_long(stat.count ? stat.sum / stat.count : 0); put_sep();
+  put_long(stat.max);
+}
+
+//Setpoint command: query it, or set it from a number with `decimals` decimals (3 for mA/mW from A/W) in [min, max]
+static void setpoint_command(const char *p, bool query, long &setpoint, uint8_t decimals, long min, long max)
+{
+  if(query){
+    if(decimals == 3) put_milli(setpoint);
+    else put_long(setpoint);
+    return;
+  }
+  long value;
+  if(!number(p, value, decimals)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  if(value < min || value > max){
+    scpi_error(SCPI_ERR_RANGE);
+    return;
+  }
+  setpoint = value;
+}
+
+//PROT:OCP/OPP/UVP/OVP: the limit in A, W or V like a setpoint, 0 = off
+static void protect_command(const char *p, bool query, uint8_t which, long max)
+{
+  long limit = protect_limit(which);
+  setpoint_command(p, query, limit, 3, 0, max);
+  if(!query) protect_set(which, limit);
+}
+
+//CAL:CURR/VOLT: the meter reading in A or V for what is measured right now, the calibration is scaled by their
+//ratio. Refused while too little flows to compare, or when the meter is off by more than 2x (wrong range, wrong probe).
+static void calibration_command(const char *p, bool query, int32_t &num, long measured)
+{
+  if(query){
+    put_long(num);
+    return;
+  }
+  long actual;
+  if(!number(p, actual, 3)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  if(measured < 100){
+    scpi_error(SCPI_ERR_CONFLICT);
+    return;
+  }
+  if(actual < measured / 2 || actual > measured * 2){
+    scpi_error(SCPI_ERR_RANGE);
+    return;
+  }
+  int64_t scaled = (int64_t)num * actual / measured;
+  if(scaled < 1 || scaled > 65535){       //raw * num has to fit in 31 bits (cal_apply)
+    scpi_error(SCPI_ERR_RANGE);
+    return;
+  }
+  num = scaled;
+  set_calibration(multiplier, voltage_multiplier());
+}
+
+//CAL:CURR:RANG/VOLT:RANG: the meter reading in A or V for what is measured right now trims the ADC range the
+//channel is in (acquisition.h); the query gives that range and its trim. Refused in the coarsest range, which
+//CAL:CURR/VOLT calibrate, under ACQ_TRIM_COUNTS and past ACQ_TRIM_MAX.
+static void range_command(const char *p, bool query, uint8_t channel, long measured, uint8_t decimals)
+{
+  uint8_t range = acq_range(channel);
+  if(query){
+    put_long(range); put_sep();
+    put_long(acq_trim(channel, range));
+    return;
+  }
+  long actual;
+  if(!number(p, actual, decimals)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  AcqSample sample;
+  acq_latest(sample);
+  int16_t raw = channel == ACQ_CURRENT ? sample.current_raw : sample.voltage_raw;
+  if(range == 0 || raw < ACQ_TRIM_COUNTS){          //the coarse range has no trim, a small reading a poor one
+    scpi_error(SCPI_ERR_CONFLICT);
+    return;
+  }
+  if(!acq_calibrate(channel, actual, measured)){
+    scpi_error(SCPI_ERR_RANGE);
+  }
+}
+
+//SYST:LCD/DAC: 7 bit I2C address in decimal, used from the next power up
+static void address_command(const char *p, bool query, uint8_t &address)
+{
+  long value = address;
+  setpoint_command(p, query, value, 0, 8, 119);
+  address = value;
+}
+
+//LIST:STEP <n>,CR|CC|CP,<ohm|A|W>,<s>[,<min V>,<max A>] stores step n (1 = first, count + 1 appends),
+//LIST:STEP? <n> returns it in the same form
+static void list_step_command(const char *p, bool query)
+{
+  long n;
+  if(!number(p, n, 0)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  SeqStep step;
+  if(query){
+    if(n < 1 || n > 255 || !seq_get(n - 1, step)){
+      scpi_error(SCPI_ERR_RANGE);
+      return;
+    }
+    put_P(mode_name(step.mode)); put_sep();
+    if(step.mode == SEQ_MODE_CR) put_long(step.setpoint);
+    else put_milli(step.setpoint);
+    put_sep();
+    put_milli(step.dwell_ms); put_sep();
+    put_milli(step.min_mV); put_sep();
+    put_milli(step.max_mA);
+    return;
+  }
+
+  long value, dwell, min_mV = 0, max_mA = 0;
+  if(!comma(p)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  skip_spaces(p);
+  if(keyword(p, PSTR("CR"))) step.mode = SEQ_MODE_CR;
+  else if(keyword(p, PSTR("CC"))) step.mode = SEQ_MODE_CC;
+  else if(keyword(p, PSTR("CP"))) step.mode = SEQ_MODE_CP;
+  else{
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  if(!comma(p) || !number(p, value, step.mode == SEQ_MODE_CR ? 0 : 3) || !comma(p) || !number(p, dwell, 3)){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  if(comma(p) && !(number(p, min_mV, 3) && comma(p) && number(p, max_mA, 3))){
+    scpi_error(SCPI_ERR_DATA);
+    return;
+  }
+  if(seq_status() == SEQ_RUNNING){
+    scpi_error(SCPI_ERR_CONFLICT);
+    return;
+  }
+  step.setpoint = value;
+  step.dwell_ms = dwell;
+  step.min_mV = min_mV;
+  step.max_mA = max_mA;
+  if(n < 1 || n > seq_count() + 1 || dwell < 0 || min_mV < 0 || min_mV > 65535L || max_mA < 0 || max_mA > 65535L){
+    scpi_error(SCPI_ERR_RANGE);
+    return;
+  }
+  if(!nvm_room(SEQ_SAVE_BYTES)) return;
+  if(!seq_set(n - 1, step)) scpi_error(SCPI_ERR_RANGE);
+}
+
+/////////////////////////////Commands//////////////////////////////////
+
+static void scpi_execute(const char *p)
+{
+  skip_spaces(p);
+  if(!*p) return;
+  bool query;
+  bool on;
+
+  if(header(p, PSTR("*IDN"), query) && query){
+    put_P(PSTR("ELECTRONOOBS,ELECTRONIC LOAD,0,1.0"));
+  }
+  else if(header(p, PSTR("*RST"), query) && !query){
+    pause = true;
+    remote_mode(1);
+    ohm_setpoint = mA_setpoint = mW_setpoint = mV_setpoint = 0;
+  }
+  else if(header(p, PSTR("MODE"), query)){
+    skip_spaces(p);
+    if(query) put_P(mode_name(Menu_level));
+    else if(keyword(p, PSTR("CR"))) remote_mode(5);
+    else if(keyword(p, PSTR("CC"))) remote_mode(6);
+    else if(keyword(p, PSTR("CP"))) remote_mode(7);
+    else if(keyword(p, PSTR("CV"))) remote_mode(17);
+    else if(keyword(p, PSTR("BATTery"))) remote_mode(9);
+    else if(keyword(p, PSTR("DYNamic"))) remote_mode(11);
+    else if(keyword(p, PSTR("LIST"))){
+      if(seq_count()) remote_mode(14);
+      else scpi_error(SCPI_ERR_CONFLICT);
+    }
+    else if(keyword(p, PSTR("OFF"))) remote_mode(1);
+    else scpi_error(SCPI_ERR_DATA);
+  }
+  else if(header(p, PSTR("RESistance"), query)){
+    setpoint_command(p, query, ohm_setpoint, 0, 1, 9999999L);
+  }
+  else if(header(p, PSTR("CURRent"), query)){
+    setpoint_command(p, query, mA_setpoint, 3, 0, MAX_SETPOINT_mA);
+  }
+  else if(header(p, PSTR("POWer"), query)){
+    setpoint_command(p, query, mW_setpoint, 3, 0, 99999L);
+  }
+  else if(header(p, PSTR("VOLTage"), query)){
+    setpoint_command(p, query, mV_setpoint, 3, 0, MAX_SETPOINT_mV);
+  }
+  else if(header(p, PSTR("INPut"), query)){
+    if(query) put_char(pause ? '0' : '1');
+    else if(!boolean_arg(p, on)) scpi_error(SCPI_ERR_DATA);
+    else if(on && protect_tripped()) scpi_error(SCPI_ERR_CONFLICT);     //PROT:CLE first
+    else pause = !on;
+  }
+  else if(header(p, PSTR("BATTery:CUToff"), query)){
+    setpoint_command(p, query, batt_cutoff_mV, 3, 0, 60000L);
+  }
+  else if(header(p, PSTR("BATTery:CAPacity"), query) && query){
+    put_milli(batt_uAh() / 1000); put_sep();
+    put_milli(batt_uWh() / 1000); put_sep();
+    put_long(batt_seconds()); put_sep();
+    put_char(batt_ended() ? '1' : '0');
+  }
+  else if(header(p, PSTR("DYNamic:LEVel1"), query)){
+    setpoint_command(p, query, dyn_level1_mA, 3, 0, MAX_SETPOINT_mA);
+  }
+  else if(header(p, PSTR("DYNamic:LEVel2"), query)){
+    setpoint_command(p, query, dyn_level2_mA, 3, 0, MAX_SETPOINT_mA);
+  }
+  else if(header(p, PSTR("DYNamic:FREQuency"), query)){
+    setpoint_command(p, query, dyn_freq_mHz, 3, 1, DYN_MAX_FREQ_mHz);
+  }
+  else if(header(p, PSTR("DYNamic:DUTY"), query)){
+    setpoint_command(p, query, dyn_duty, 0, 1, 99);
+  }
+  else if(header(p, PSTR("DYNamic:SLEW"), query)){
+    setpoint_command(p, query, dyn_slew, 3, 0, MAX_SETPOINT_mA);
+  }
+  else if(header(p, PSTR("LIST:STEP"), query)){
+    list_step_command(p, query);
+  }
+  else if(header(p, PSTR("LIST:COUNt"), query) && query){
+    put_long(seq_count());
+  }
+  else if(header(p, PSTR("LIST:CLEar"), query) && !query){
+    if(seq_status() == SEQ_RUNNING) scpi_error(SCPI_ERR_CONFLICT);
+    else if(nvm_room(2)) seq_truncate(0);
+  }
+  else if(header(p, PSTR("LIST:STATus"), query) && query){
+    uint8_t status = seq_status();
+    put_P(status == SEQ_RUNNING ? PSTR("RUN") : status == SEQ_DONE ? PSTR("DONE") : status == SEQ_LIMIT ? PSTR("LIMIT") : PSTR("OFF"));
+    put_sep();
+    put_long(status == SEQ_STOPPED ? 0 : seq_index() + 1);
+  }
+  else if(header(p, PSTR("CALibration:SWEep"), query) && !query){
+    remote_mode(15);
+  }
+  else if(header(p, PSTR("CALibration:STATus"), query) && query){
+    uint8_t status = ff_status();
+    put_P(status == FF_SWEEP ? PSTR("RUN") : status == FF_SAVE || status == FF_DONE ? PSTR("DONE") : status == FF_FAIL ? PSTR("FAIL") :
+            ff_calibrated() ? PSTR("CAL") : PSTR("NOM"));
+    put_sep();
+    put_long(status == FF_IDLE ? 0 : ff_point());
+  }
+  else if(header(p, PSTR("CALibration:TABle"), query) && query){
+    for(uint8_t i = 0; i < FF_POINTS; i++){
+      if(i) put_sep();
+      put_long(ff_table(i));
+    }
+  }
+  else if(header(p, PSTR("CALibration:CLEar"), query) && !query){
+    if(nvm_room(1)) ff_clear();
+  }
+  else if(header(p, PSTR("CALibration:CURRent"), query)){
+    calibration_command(p, query, multiplier, voltage_on_load);
+  }
+  else if(header(p, PSTR("CALibration:VOLTage"), query)){
+    calibration_command(p, query, voltage_multiplier(), voltage_read);
+  }
+  else if(header(p, PSTR("CALibration:CURRent:RANGe"), query)){
+    range_command(p, query, ACQ_CURRENT, current_uA, 6);
+  }
+  else if(header(p, PSTR("CALibration:VOLTage:RANGe"), query)){
+    range_command(p, query, ACQ_VOLTAGE, voltage_read, 3);
+  }
+  else if(header(p, PSTR("PROFile:STATistics"), query) && query){
+    profile_query(p, false);
+  }
+  else if(header(p, PSTR("PROFile:HISTogram"), query) && query){
+    profile_query(p, true);
+  }
+  else if(header(p, PSTR("PROFile:RESet"), query) && !query){
+    prof_reset();
+  }
+  else if(header(p, PSTR("PROTection:OCP"), query)){
+    protect_command(p, query, PROTECT_OCP, 6000);
+  }
+  else if(header(p, PSTR("PROTection:OPP"), query)){
+    protect_command(p, query, PROTECT_OPP, 200000L);
+  }
+  else if(header(p, PSTR("PROTection:UVP"), query)){
+    protect_command(p, query, PROTECT_UVP, 65000L);
+  }
+  else if(header(p, PSTR("PROTection:OVP"), query)){
+    protect_command(p, query, PROTECT_OVP, 65000L);
+  }
+  else if(header(p, PSTR("PROTection:TRIPped"), query) && query){
+    uint8_t trip = protect_tripped();
+    if(!trip) put_P(PSTR("NONE"));
+    for(uint8_t bit = PROTECT_OCP; bit <= PROTECT_SENSE; bit <<= 1){
+      if(!(trip & bit)) continue;
+      if(trip & (bit - 1)) put_sep();
+      put_P(protect_name(bit));
+    }
+  }
+  else if(header(p, PSTR("PROTection:CLEar"), query) && !query){
+    protect_clear();
+  }
+  else if(header(p, PSTR("MEASure:TEMPerature"), query) && query){
+    if(therm_valid()) put_milli(therm_temperature() * 100L);
+    else put_P(PSTR("NAN"));
+  }
+  else if(header(p, PSTR("MEASure:FAN"), query) && query){
+    put_long((therm_fan() * 100L + 127) / 255);
+  }
+  else if(header(p, PSTR("MEASure:DERating"), query) && query){
+    put_long((therm_derate() * 100L + 128) >> 8);
+  }
+  else if(header(p, PSTR("MEASure:CURRent"), query) && query){
+    put_micro(current_uA);
+  }
+  else if(header(p, PSTR("MEASure:VOLTage"), query) && query){
+    put_milli(voltage_read);
+  }
+  else if(header(p, PSTR("MEASure:POWer"), query) && query){
+    put_milli(power_read);
+  }
+  else if(header(p, PSTR("SENSe:REMote"), query)){
+    if(query) put_char(sense_remote() ? '1' : '0');
+    else if(boolean_arg(p, on)) set_remote_sense(on);
+    else scpi_error(SCPI_ERR_DATA);
+  }
+  else if(header(p, PSTR("SENSe:TERMinal"), query) && query){
+    put_milli(sense_terminal_mV());
+  }
+  else if(header(p, PSTR("STATus"), query) && query){
+    put_P(mode_name(Menu_level)); put_sep();
+    put_char(pause ? '0' : '1'); put_sep();
+    put_milli(voltage_read); put_sep();
+    put_milli(voltage_on_load); put_sep();
+    put_milli(power_read);
+  }
+  else if(header(p, PSTR("TELemetry"), query)){
+    if(query) put_char(telemetry_enabled() ? '1' : '0');
+    else if(boolean_arg(p, on)) telemetry_enable(on);
+    else scpi_error(SCPI_ERR_DATA);
+  }
+  else if(header(p, PSTR("SYSTem:LCD"), query)){
+    address_command(p, query, lcd_address);
+  }
+  else if(header(p, PSTR("SYSTem:DAC"), query)){
+    address_command(p, query, dac_address);
+  }
+  else if(header(p, PSTR("SYSTem:ERRor"), query) && query){
+    if(error_count){
+      int16_t code = errors[0];
+      put_long(code);
+      put_P(code == SCPI_ERR_RANGE ? PSTR(",Data out of range") :
+              code == SCPI_ERR_DATA ? PSTR(",Data type error") :
+              code == SCPI_ERR_CONFLICT ? PSTR(",Settings conflict") :
+              code == SCPI_ERR_TOO_LONG ? PSTR(",Too much data") :
+              code == SCPI_ERR_OVERRUN ? PSTR(",Input buffer overrun") :
+              PSTR(",Undefined header"));
+      error_count--;
+      for(uint8_t i = 0; i < error_count; i++) errors[i] = errors[i + 1];
+    }
+    else{
+      put_P(PSTR("0,No error"));
+    }
+  }
+  else{
+    scpi_error(SCPI_ERR_HEADER);
+  }
+}
+
+//Run every ';' separated command from `command` on, the replies of the queries go in one line separated by ';'.
+//A command that holds stops the line: the rest of it goes to `held` and runs from there on the next call.
+static void scpi_line(char *command)
+{
+  for(;;){
+    char *end = command;
+    while(*end && *end != ';') end++;
+    bool last = (*end == 0);
+    *end = 0;
+    bool separator = (reply_len != 0);
+    if(separator) put_char(';');
+    uint8_t mark = reply_len;
+    hold = false;
+    scpi_execute(command);
+    if(hold){                                         //nothing done yet, the replies so far wait with it
+      if(separator) reply_len--;
+      if(!last) *end = ';';
+      memmove(held, command, strlen(command) + 1);
+      holding = true;
+      return;
+    }
+    if(separator && reply_len == mark) reply_len--;   //not a query, drop the separator
+    if(last) break;
+    command = end + 1;
+  }
+  holding = false;
+  if(reply_len) reply[reply_len++] = '\n';
+}
+
+void scpi_poll()
+{
+  if(uart_rx_overflow() && !(error_count && errors[error_count - 1] == SCPI_ERR_OVERRUN)){
+    scpi_error(SCPI_ERR_OVERRUN);                     //once for a burst, not for every pass it goes on
+  }
+  for(;;){
+    if(holding) scpi_line(held);
+    if(!holding && reply_len && uart_write((const uint8_t *)reply, reply_len)) reply_len = 0;
+    int c;
+    while(!line_done && (c = uart_read()) >= 0){    //input is read on while a line waits, up to the next whole one
+      if(c == '\n' || c == '\r'){
+        line_done = line_len || line_overflow;
+      }
+      else if(line_len < SCPI_LINE_LEN){
+        line[line_len++] = c;
+      }
+      else{
+        line_overflow = true;
+      }
+    }
+    if(!line_done || holding || reply_len) return;  //the RX buffer keeps what comes after a waiting line
+    if(line_overflow) scpi_error(SCPI_ERR_TOO_LONG);
+    else{
+      line[line_len] = 0;
+      scpi_line(line);
+    }
+    line_len = 0;
+    line_overflow = false;
+    line_done = false;
+  }
+}
@@ -0,0 +1,40 @@
+#include "sense.h"
+#include "acquisition.h"
+#include "protect.h"
+
+static long terminal_mV = 0;
+static uint8_t outside = 0;             //readings in a row outside the window
+
+
+void sense_set_remote(bool remote)
+{
+  acq_set_remote(remote);
+  outside = 0;
+}
+
+bool sense_remote()
+{
+  return acq_remote();
+}
+
+void sense_check(int16_t counts, long voltage_mV)
+{
+  terminal_mV = ((long)counts * SENSE_TERMINAL_uV + 500) / 1000;
+  if(!acq_remote()){                    //no separate leads to lose, and a board from before the A7 divider
+    outside = 0;                        //must still turn on
+    return;
+  }
+  long tolerance = SENSE_TOLERANCE_mV + terminal_mV / 16;
+  if(voltage_mV >= terminal_mV - tolerance && voltage_mV <= terminal_mV + SENSE_LEAD_MAX_mV + tolerance){
+    outside = 0;
+    return;
+  }
+  if(++outside < SENSE_OPEN_COUNT) return;
+  outside = 0;
+  protect_trip(PROTECT_SENSE);
+}
+
+long sense_terminal_mV()
+{
+  return terminal_mV;
+}
@@ -0,0 +1,210 @@
+#include "sequence.h"
+#include "nvm.h"
+#include "tick.h"
+#include "mcp4725.h"
+#include "regulator.h"
+
+extern Mcp4725 dac;
+
+//Timer side: the running step's time left and the next step's dwell, loaded by loop() ahead of time
+static volatile uint32_t remaining_ms = 0;
+static volatile uint32_t next_dwell_ms = 0;
+static volatile uint8_t step_index = 0;
+static volatile bool advanced = false;
+static volatile bool held = false;
+
+//loop() side
+static uint8_t status = SEQ_STOPPED;
+static SeqStep current;
+
+
+/////////////////////////////Stored list//////////////////////////////////
+
+static uint16_t step_address(uint8_t index)
+{
+  return SEQ_EEPROM_ADDR + 2 + (uint16_t)index * SEQ_STEP_BYTES;
+}
+
+uint8_t seq_count()
+{
+  uint8_t header[2];
+  nvm_read(SEQ_EEPROM_ADDR, header, 2);
+  if(header[0] != SEQ_MAGIC || header[1] > SEQ_MAX_STEPS) return 0;   //blank or foreign EEPROM: empty list
+  return header[1];
+}
+
+bool seq_valid(const SeqStep &step)
+{
+  if(step.mode != SEQ_MODE_CR && step.mode != SEQ_MODE_CC && step.mode != SEQ_MODE_CP) return false;
+  long max = step.mode == SEQ_MODE_CR ? 9999999L : step.mode == SEQ_MODE_CC ? MAX_SETPOINT_mA : 99999L;
+  if(step.setpoint < 0 || step.setpoint > max) return false;
+  return step.dwell_ms >= SEQ_MIN_DWELL_MS;
+}
+
+bool seq_get(uint8_t index, SeqStep &step)
+{
+  if(index >= seq_count()) return false;
+  uint8_t b[SEQ_STEP_BYTES];
+  nvm_read(step_address(index), b, SEQ_STEP_BYTES);
+  step.mode = b[0];
+  step.setpoint = b[1] | ((long)b[2] << 8) | ((long)b[3] << 16);
+  step.dwell_ms = b[4] | ((uint32_t)b[5] << 8) | ((uint32_t)b[6] << 16) | ((uint32_t)b[7] << 24);
+  step.min_mV = b[8] | (b[9] << 8);
+  step.max_mA = b[10] | (b[11] << 8);
+  return seq_valid(step);
+}
+
+bool seq_set(uint8_t index, const SeqStep &step)
+{
+  uint8_t count = seq_count();
+  if(status == SEQ_RUNNING || index > count || index >= SEQ_MAX_STEPS || !seq_valid(step)) return false;
+  if(nvm_free() < SEQ_SAVE_BYTES) return false;
+  uint8_t b[SEQ_STEP_BYTES];
+  b[0] = step.mode;
+  b[1] = step.setpoint;
+  b[2] = step.setpoint >> 8;
+  b[3] = step.setpoint >> 16;
+  b[4] = step.dwell_ms;
+  b[5] = step.dwell_ms >> 8;
+  b[6] = step.dwell_ms >> 16;
+  b[7] = step.dwell_ms >> 24;
+  b[8] = step.min_mV;
+  b[9] = step.min_mV >> 8;
+  b[10] = step.max_mA;
+  b[11] = step.max_mA >> 8;
+  nvm_write(step_address(index), b, SEQ_STEP_BYTES);
+  uint8_t header[2] = {SEQ_MAGIC, (uint8_t)(index == count ? count + 1 : count)};
+  nvm_write(SEQ_EEPROM_ADDR, header, 2);    //after the step, so a reset in between never counts a half written step
+  return true;
+}
+
+bool seq_truncate(uint8_t count)
+{
+  if(status == SEQ_RUNNING || nvm_free() < 2) return false;
+  if(count >= seq_count()) return true;
+  uint8_t header[2] = {SEQ_MAGIC, count};
+  nvm_write(SEQ_EEPROM_ADDR, header, 2);
+  return true;
+}
+
+
+/////////////////////////////Running it//////////////////////////////////
+
+//Timer interrupt, every ms
+static void seq_tick()
+{
+  if(held || !remaining_ms) return;
+  if(--remaining_ms) return;
+  step_index++;
+  remaining_ms = next_dwell_ms;       //0 if there is no next step
+  next_dwell_ms = 0;
+  advanced = true;
+  if(!remaining_ms){
+    dac.setVoltage(0, false);         //end of the list, on time
+  }
+}
+
+//Dwell of the step after `index` for the timer, 0 when `index` is the last one
+static void load_next(uint8_t index)
+{
+  SeqStep next;
+  uint32_t dwell = seq_get(index + 1, next) ? next.dwell_ms : 0;
+  uint8_t sreg = SREG;
+  cli();
+  next_dwell_ms = dwell;
+  SREG = sreg;
+}
+
+bool seq_start()
+{
+  tick_stop();
+  if(!seq_get(0, current)){
+    status = SEQ_STOPPED;
+    return false;
+  }
+  step_index = 0;
+  advanced = false;
+  held = false;
+  remaining_ms = current.dwell_ms;
+  load_next(0);
+  status = SEQ_RUNNING;
+  tick_start(seq_tick);
+  return true;
+}
+
+void seq_stop()
+{
+  tick_stop();
+  remaining_ms = 0;
+  if(status == SEQ_RUNNING) status = SEQ_STOPPED;
+}
+
+void seq_hold(bool hold)
+{
+  held = hold;
+}
+
+void seq_poll()
+{
+  if(status != SEQ_RUNNING || !advanced) return;
+  uint8_t sreg = SREG;
+  cli();
+  advanced = false;
+  uint8_t now = step_index;
+  bool running = remaining_ms != 0;
+  SREG = sreg;
+  if(!running){
+    tick_stop();
+    status = SEQ_DONE;
+    step_index = now - 1;             //report the last step
+    return;
+  }
+  seq_get(now, current);
+  load_next(now);
+}
+
+uint8_t seq_status()
+{
+  return status;
+}
+
+uint8_t seq_index()
+{
+  return step_index;
+}
+
+const SeqStep &seq_step()
+{
+  return current;
+}
+
+uint32_t seq_remaining_ms()
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t ms = remaining_ms;
+  SREG = sreg;
+  return ms;
+}
+
+bool seq_check(long mV, long mA)
+{
+  if(status != SEQ_RUNNING) return true;
+  if((current.min_mV && mV < current.min_mV) || (current.max_mA && mA > current.max_mA)){
+    seq_stop();
+    status = SEQ_LIMIT;
+    dac.setVoltage(0, false);
+    return false;
+  }
+  return true;
+}
+
+void seq_output(uint16_t code)
+{
+  uint8_t sreg = SREG;
+  cli();
+  if(remaining_ms){                   //the timer has not ended the list
+    dac.setVoltage(code, false);
+  }
+  SREG = sreg;
+}
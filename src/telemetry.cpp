@@ -0,0 +1,61 @@
+#include "telemetry.h"
+#include "uart.h"
+#include "crc.h"
+
+static uint8_t tlm_seq = 0;
+static uint16_t tlm_dropped = 0;
+static bool tlm_gap = false;
+static bool tlm_on = true;
+
+static uint8_t *put16(uint8_t *p, uint16_t value)
+{
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+  return p + 2;
+}
+
+void telemetry_begin()
+{
+  uart_begin(TELEMETRY_BAUD);
+}
+
+void telemetry_send(const AcqSample &sample, uint16_t dac, uint8_t mode, uint8_t flags)
+{
+  if(!tlm_on){
+    return;
+  }
+  uint8_t frame[TLM_FRAME_LEN];
+  uint8_t *p = frame;
+  *p++ = 0xA5;
+  *p++ = 0x5A;
+  *p++ = tlm_seq++;
+  p = put16(p, sample.stamp_us & 0xFFFF);
+  p = put16(p, sample.stamp_us >> 16);
+  p = put16(p, sample.current_raw);
+  p = put16(p, sample.voltage_raw);
+  p = put16(p, dac);
+  *p++ = mode;
+  *p++ = flags | (tlm_gap ? TLM_FLAG_DROPPED : 0);
+  *p++ = sample.current_range | (sample.voltage_range << 4);
+  put16(p, crc_block(0xFFFF, frame + 2, p - (frame + 2)));
+
+  tlm_gap = !uart_write(frame, TLM_FRAME_LEN);
+  if(tlm_gap){
+    tlm_dropped++;
+  }
+}
+
+uint16_t telemetry_dropped()
+{
+  return tlm_dropped;
+}
+
+void telemetry_enable(bool on)
+{
+  tlm_on = on;
+}
+
+bool telemetry_enabled()
+{
+  return tlm_on;
+}
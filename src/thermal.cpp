@@ -0,0 +1,90 @@
+#include "thermal.h"
+#include "protect.h"
+
+//A6 counts (10 bit of the 5V supply, so the reading does not depend on it) of the NTC divider at 0, 10 ... 150C
+#define THERM_POINTS  16
+static const int16_t ntc_counts[THERM_POINTS] = {
+  789, 685, 570, 456, 355, 270, 204, 153, 115, 87, 67, 51, 40, 31, 25, 20
+};
+
+static int16_t temperature = 0;         //tenths of a degree C
+static bool valid = false;
+static uint8_t fan = 0;
+static long fan_integral = 0;           //Q8 duty
+static uint16_t derate = 256;
+
+
+//Counts to tenths of a degree, false outside the table
+static bool therm_convert(int16_t raw, int16_t &tenths)
+{
+  if(raw > ntc_counts[0] || raw < ntc_counts[THERM_POINTS - 1]) return false;
+  uint8_t i = 0;
+  while(i < THERM_POINTS - 2 && raw < ntc_counts[i + 1]) i++;
+  long span = ntc_counts[i] - ntc_counts[i + 1];
+  tenths = i * 100 + (long)(ntc_counts[i] - raw) * 100 / span;
+  return true;
+}
+
+static void therm_fan_write(uint8_t duty)
+{
+  fan = duty;
+  analogWrite(THERM_FAN_PIN, duty);
+}
+
+void therm_begin()
+{
+  pinMode(THERM_FAN_PIN, OUTPUT);
+  fan_integral = 0;
+  derate = 256;
+  valid = false;
+  therm_fan_write(0);
+}
+
+void therm_sample(int16_t raw)
+{
+  valid = therm_convert(raw, temperature);
+  if(!valid){
+    derate = 256;
+    therm_fan_write(255);
+    return;
+  }
+
+  long error = temperature - THERM_FAN_C;
+  fan_integral = constrain(fan_integral + error * THERM_FAN_KI, 0L, 255L << 8);
+  long duty = ((error * THERM_FAN_KP) >> 4) + (fan_integral >> 8);
+  duty = constrain(duty, 0L, 255L);
+  if(duty && duty < THERM_FAN_MIN_DUTY) duty = THERM_FAN_MIN_DUTY;
+  therm_fan_write(duty);
+
+  if(temperature <= THERM_DERATE_C) derate = 256;
+  else if(temperature >= THERM_MAX_C) derate = 0;
+  else derate = 256L * (THERM_MAX_C - temperature) / (THERM_MAX_C - THERM_DERATE_C);
+  if(temperature >= THERM_MAX_C){
+    protect_trip(PROTECT_OTP);
+  }
+}
+
+bool therm_valid()
+{
+  return valid;
+}
+
+int16_t therm_temperature()
+{
+  return temperature;
+}
+
+uint8_t therm_fan()
+{
+  return fan;
+}
+
+uint16_t therm_derate()
+{
+  return derate;
+}
+
+long therm_limit(long mA)
+{
+  return (mA * derate) >> 8;              //mA < 2^23
+}
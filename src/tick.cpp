@@ -0,0 +1,52 @@
+#include "tick.h"
+
+static volatile TickHandler tick_handler = 0;
+
+void tick_start(TickHandler handler)
+{
+  tick_hw_stop();
+  tick_handler = handler;
+  tick_hw_start(TICK_US);
+}
+
+void tick_stop()
+{
+  tick_hw_stop();
+  tick_handler = 0;
+}
+
+void tick_interrupt()
+{
+  TickHandler handler = tick_handler;
+  if(handler){
+    handler();
+  }
+}
+
+
+
+#ifdef __AVR__
+/////////////////////////////Timer1 hardware layer//////////////////////////////////
+
+void tick_hw_start(uint16_t period_us)
+{
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12);                          //CTC on OCR1A, stopped
+  TCNT1 = 0;
+  OCR1A = (F_CPU / 64) * period_us / 1000000UL - 1;  //prescaler 64: 4us per count at 16MHz
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+  TCCR1B |= _BV(CS11) | _BV(CS10);              //start, clk/64
+}
+
+void tick_hw_stop()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  tick_interrupt();
+}
+#endif
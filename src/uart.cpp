@@ -0,0 +1,117 @@
+#include "uart.h"
+
+static uint8_t tx_buf[UART_TX_SIZE];
+static volatile uint8_t tx_head = 0;            //written by uart_write()
+static volatile uint8_t tx_tail = 0;            //written by the TX interrupt
+static uint8_t rx_buf[UART_RX_SIZE];
+static volatile uint8_t rx_head = 0;            //written by the RX interrupt
+static volatile uint8_t rx_tail = 0;            //written by uart_read()
+static volatile bool rx_lost = false;           //set by the RX interrupt, cleared by uart_rx_overflow()
+
+void uart_begin(uint32_t baud)
+{
+  tx_head = tx_tail = 0;
+  rx_head = rx_tail = 0;
+  rx_lost = false;
+  uart_hw_begin(baud);
+}
+
+uint8_t uart_tx_free()
+{
+  return (UART_TX_SIZE - 1) - (uint8_t)((tx_head - tx_tail) & (UART_TX_SIZE - 1));
+}
+
+bool uart_write(const uint8_t *data, uint8_t len)
+{
+  if(len > uart_tx_free()){
+    return false;
+  }
+  uint8_t head = tx_head;
+  for(uint8_t i = 0; i < len; i++){
+    tx_buf[head] = data[i];
+    head = (head + 1) & (UART_TX_SIZE - 1);
+  }
+  tx_head = head;                               //one byte store: the interrupt sees all of it or none
+  uart_hw_kick();
+  return true;
+}
+
+bool uart_tx_pop(uint8_t &value)
+{
+  uint8_t tail = tx_tail;
+  if(tail == tx_head){
+    return false;
+  }
+  value = tx_buf[tail];
+  tx_tail = (tail + 1) & (UART_TX_SIZE - 1);
+  return true;
+}
+
+int uart_read()
+{
+  uint8_t tail = rx_tail;
+  if(tail == rx_head){
+    return -1;
+  }
+  uint8_t value = rx_buf[tail];
+  rx_tail = (tail + 1) & (UART_RX_SIZE - 1);
+  return value;
+}
+
+bool uart_rx_overflow()
+{
+  uint8_t sreg = SREG;
+  cli();
+  bool lost = rx_lost;
+  rx_lost = false;
+  SREG = sreg;
+  return lost;
+}
+
+void uart_rx_push(uint8_t value)
+{
+  uint8_t next = (rx_head + 1) & (UART_RX_SIZE - 1);
+  if(next == rx_tail){                          //full
+    rx_lost = true;
+    return;
+  }
+  rx_buf[rx_head] = value;
+  rx_head = next;
+}
+
+
+#ifdef __AVR__
+/////////////////////////////USART0 hardware layer//////////////////////////////////
+
+void uart_hw_begin(uint32_t baud)
+{
+  UCSR0A = _BV(U2X0);                           //double speed: 8 samples per bit, exact 500k/1M at 16MHz
+  uint16_t ubrr = (F_CPU / 8 / baud) - 1;
+  UBRR0H = ubrr >> 8;
+  UBRR0L = ubrr & 0xFF;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);           //8N1
+  UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
+}
+
+void uart_hw_kick()
+{
+  UCSR0B |= _BV(UDRIE0);                        //fires right away if the data register is empty
+}
+
+ISR(USART_UDRE_vect)
+{
+  uint8_t value;
+  if(uart_tx_pop(value)){
+    UDR0 = value;
+  }
+  else{
+    UCSR0B &= ~_BV(UDRIE0);                     //nothing left, wait for the next kick
+  }
+}
+
+ISR(USART_RX_vect)
+{
+  uint8_t value = UDR0;                         //reading clears the interrupt, even if the byte is dropped
+  uart_rx_push(value);
+}
+#endif